@@ -0,0 +1,395 @@
+#include "analysis.h"
+#include "tiles.h"
+#include "pngcodec.h"
+#include <math.h>
+
+// One worker's share of the pixel data and the partial statistics it produces
+struct AnalysisJob {
+    const uint8_t* pixels;
+    const uint8_t* cover;   // Optional, for the mismatch count and PSNR
+    long start;             // First byte of this share (a multiple of one 4-pixel group)
+    long end;
+    long size;              // Size of the whole buffer, so pairs may cross into the next share
+    uint64_t histogram[256];
+    uint64_t rs[RS_COUNTERS];
+    uint64_t spa[SPA_COUNTERS];
+    uint64_t mismatches;
+    double squaredError;
+    WorkerTask task;
+};
+
+// LSB flip (F1) and its shifted counterpart (F-1) used by RS analysis, written without branches
+#define FLIP_POSITIVE(x) ((x) + 1 - (((x) & 1) << 1))
+#define FLIP_NEGATIVE(x) ((x) - 1 + (((x) & 1) << 1))
+
+// Classify one group of four samples under the mask [0 1 1 0] and its negation as regular
+// (smoothness increases) or singular (smoothness decreases)
+#define CLASSIFY_GROUP(x0, x1, x2, x3, rm, sm, rnm, snm) do {                                   \
+        int f_ = abs((x1) - (x0)) + abs((x2) - (x1)) + abs((x3) - (x2));                      \
+        int p1_ = FLIP_POSITIVE(x1), p2_ = FLIP_POSITIVE(x2);                                  \
+        int n1_ = FLIP_NEGATIVE(x1), n2_ = FLIP_NEGATIVE(x2);                                  \
+        int positive_ = abs(p1_ - (x0)) + abs(p2_ - p1_) + abs((x3) - p2_);                    \
+        int negative_ = abs(n1_ - (x0)) + abs(n2_ - n1_) + abs((x3) - n2_);                    \
+        rm += positive_ > f_;                                                                  \
+        sm += positive_ < f_;                                                                  \
+        rnm += negative_ > f_;                                                                 \
+        snm += negative_ < f_;                                                                 \
+    } while (0)
+
+// Gather every statistic for one share in a single pass over its 4-pixel groups, adding them to
+// what the job has gathered from earlier bands
+static void analysisWorker(void* argument) {
+    AnalysisJob* job = (AnalysisJob*)argument;
+    const uint8_t* pixels = job->pixels;
+
+    // Counters live in locals: the byte pointer could alias the job, which would force every
+    // increment through memory
+    uint64_t rm = 0, sm = 0, rnm = 0, snm = 0;
+    uint64_t frm = 0, fsm = 0, frnm = 0, fsnm = 0;
+    uint64_t pairs = 0, w = 0, x = 0, y = 0, z = 0;
+    uint32_t histograms[4][256] = { { 0 } }; // Interleaved to avoid stalls on repeated values
+
+    for (long g = job->start; g + 4 * 3 <= job->end; g += 4 * 3) {
+        const uint8_t* group = pixels + g;
+        for (int c = 0; c < 3; ++c) {
+            int x0 = group[c], x1 = group[c + 3], x2 = group[c + 6], x3 = group[c + 9];
+            CLASSIFY_GROUP(x0, x1, x2, x3, rm, sm, rnm, snm);
+            CLASSIFY_GROUP(x0 ^ 1, x1 ^ 1, x2 ^ 1, x3 ^ 1, frm, fsm, frnm, fsnm);
+        }
+        // Flush the 32-bit histograms well before they can overflow
+        if (((g - job->start) & ((1L << 28) - 1)) == 0 && g != job->start) {
+            for (int v = 0; v < 256; v++) {
+                job->histogram[v] += (uint64_t)histograms[0][v] + histograms[1][v] + histograms[2][v] + histograms[3][v];
+                histograms[0][v] = histograms[1][v] = histograms[2][v] = histograms[3][v] = 0;
+            }
+        }
+        for (int i = 0; i < 12; ++i) {
+            histograms[i & 3][group[i]]++;
+        }
+    }
+
+    // Pair each sample with the same component of the next pixel
+    long pairEnd = job->end < job->size - 3 ? job->end : job->size - 3;
+    for (long i = job->start; i < pairEnd; ++i) {
+        int u = pixels[i];
+        int v = pixels[i + 3];
+        int odd = v & 1;
+        pairs++;
+        w += ((u >> 1) == (v >> 1)) & (u != v);
+        z += (u == v);
+        x += odd ? (u > v) : (u < v);
+        y += odd ? (u < v) : (u > v);
+    }
+
+    // Samples in a trailing partial group still count towards the histogram
+    for (long i = job->start + (job->end - job->start) / 12 * 12; i < job->end; ++i) {
+        histograms[0][pixels[i]]++;
+    }
+
+    for (int v = 0; v < 256; v++) {
+        job->histogram[v] += (uint64_t)histograms[0][v] + histograms[1][v] + histograms[2][v] + histograms[3][v];
+    }
+    job->rs[RS_RM] += rm;
+    job->rs[RS_SM] += sm;
+    job->rs[RS_RNM] += rnm;
+    job->rs[RS_SNM] += snm;
+    job->rs[RS_FLIPPED + RS_RM] += frm;
+    job->rs[RS_FLIPPED + RS_SM] += fsm;
+    job->rs[RS_FLIPPED + RS_RNM] += frnm;
+    job->rs[RS_FLIPPED + RS_SNM] += fsnm;
+    job->spa[SPA_P] += pairs;
+    job->spa[SPA_W] += w;
+    job->spa[SPA_X] += x;
+    job->spa[SPA_Y] += y;
+    job->spa[SPA_Z] += z;
+
+    if (job->cover) {
+        const uint8_t* cover = job->cover;
+        uint64_t mismatches = 0;
+        uint64_t squared = 0;
+        for (long i = job->start; i < job->end; ++i) {
+            int d = (int)pixels[i] - (int)cover[i];
+            mismatches += (d != 0);
+            squared += (uint64_t)(d * d);
+        }
+        job->mismatches += mismatches;
+        job->squaredError += (double)squared;
+    }
+}
+
+// Regularized upper incomplete gamma function Q(a, x)
+static double gammaQ(double a, double x) {
+    if (x <= 0) return 1.0;
+    double logPrefix = -x + a * log(x) - lgamma(a);
+    if (x < a + 1) {
+        // Series expansion of P(a, x)
+        double term = 1.0 / a, sum = term;
+        for (int n = 1; n < 1000 && fabs(term) > fabs(sum) * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+        return 1.0 - sum * exp(logPrefix);
+    }
+    // Continued fraction for Q(a, x) (modified Lentz)
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for (int n = 1; n < 1000; n++) {
+        double an = -n * (n - a);
+        b += 2;
+        d = an * d + b;
+        if (fabs(d) < 1e-300) d = 1e-300;
+        c = b + an / c;
+        if (fabs(c) < 1e-300) c = 1e-300;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1) < 1e-15) break;
+    }
+    return exp(logPrefix) * h;
+}
+
+// Westfeld's chi-square attack: probability that pairs of values (2k, 2k+1) have equal frequencies
+static double chiSquareProbability(const uint64_t* histogram) {
+    double chiSquare = 0;
+    int categories = 0;
+    for (int k = 0; k < 128; k++) {
+        double expected = (histogram[2 * k] + histogram[2 * k + 1]) / 2.0;
+        if (expected < 5) continue; // Too few samples for the approximation
+        double difference = histogram[2 * k] - expected;
+        chiSquare += difference * difference / expected;
+        categories++;
+    }
+    if (categories < 2) return 0;
+    return gammaQ((categories - 1) / 2.0, chiSquare / 2.0);
+}
+
+// Smaller-magnitude root of a x^2 + b x + c = 0
+static double smallerRoot(double a, double b, double c) {
+    if (fabs(a) < 1e-12) {
+        return fabs(b) < 1e-12 ? 0 : -c / b;
+    }
+    double discriminant = b * b - 4 * a * c;
+    if (discriminant < 0) discriminant = 0;
+    double root1 = (-b + sqrt(discriminant)) / (2 * a);
+    double root2 = (-b - sqrt(discriminant)) / (2 * a);
+    return fabs(root1) <= fabs(root2) ? root1 : root2;
+}
+
+// Clamp an embedding rate estimate to [0, 1]
+static double clampRate(double rate) {
+    return rate < 0 ? 0 : (rate > 1 ? 1 : rate);
+}
+
+// Fridrich's RS estimate of the fraction of samples with a modified LSB
+static double rsEstimate(const uint64_t* rs) {
+    double d0 = (double)rs[RS_RM] - rs[RS_SM];
+    double d1 = (double)rs[RS_FLIPPED + RS_RM] - rs[RS_FLIPPED + RS_SM];
+    double n0 = (double)rs[RS_RNM] - rs[RS_SNM];
+    double n1 = (double)rs[RS_FLIPPED + RS_RNM] - rs[RS_FLIPPED + RS_SNM];
+    double x = smallerRoot(2 * (d1 + d0), n0 - n1 - d1 - 3 * d0, d0 - n0);
+    if (fabs(x - 0.5) < 1e-12) return 1;
+    return clampRate(x / (x - 0.5));
+}
+
+// Dumitrescu's sample pair estimate of the fraction of samples with a modified LSB
+static double spaEstimate(const uint64_t* spa) {
+    double a = (spa[SPA_W] + spa[SPA_Z]) / 2.0;
+    double b = 2.0 * spa[SPA_X] - (double)spa[SPA_P];
+    double c = (double)spa[SPA_Y] - spa[SPA_X];
+    return clampRate(smallerRoot(a, b, c));
+}
+
+// Clear running totals before the first band and set up one job per thread the pool can run; the
+// jobs come from the arena and are reused for every band
+int analysisBegin(AnalysisTotals* totals, StegoArena* arena, WorkerPool* workers) {
+    memset(totals, 0, sizeof(*totals));
+    totals->workers = workers;
+    totals->jobCount = workerPoolSize(workers);
+    if (totals->jobCount > ANALYSIS_MAX_THREADS) totals->jobCount = ANALYSIS_MAX_THREADS;
+    totals->jobs = (AnalysisJob*)arenaAlloc(arena, totals->jobCount * sizeof(AnalysisJob));
+    if (!totals->jobs) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    memset(totals->jobs, 0, totals->jobCount * sizeof(AnalysisJob));
+    return SUCCESSFUL;
+}
+
+// Add one band of pixel data to the running totals in a single multithreaded pass. Bands must be
+// passed in order and, except for the last one, be a whole number of 4-pixel groups.
+int analyzeBand(const uint8_t* pixels, const uint8_t* cover, long size, AnalysisTotals* totals) {
+    // Pairs that straddle the previous band and this one
+    for (int j = 0; j < totals->tailLength && j < size; j++) {
+        int u = totals->tail[j];
+        int v = pixels[j];
+        int odd = v & 1;
+        totals->spa[SPA_P]++;
+        totals->spa[SPA_W] += ((u >> 1) == (v >> 1)) & (u != v);
+        totals->spa[SPA_Z] += (u == v);
+        totals->spa[SPA_X] += odd ? (u > v) : (u < v);
+        totals->spa[SPA_Y] += odd ? (u < v) : (u > v);
+    }
+
+    // Split the data into group-aligned shares, one per job
+    long threads = size / ANALYSIS_MIN_BYTES_PER_THREAD;
+    if (threads > totals->jobCount) threads = totals->jobCount;
+    if (threads < 1) threads = 1;
+
+    AnalysisJob* jobs = totals->jobs;
+    long share = (size / threads) / (4 * 3) * (4 * 3);
+    for (long t = 0; t < threads; t++) {
+        jobs[t].pixels = pixels;
+        jobs[t].cover = cover;
+        jobs[t].start = t * share;
+        jobs[t].end = (t == threads - 1) ? size : (t + 1) * share;
+        jobs[t].size = size;
+        // The calling thread takes the first share itself
+        if (t > 0) workerPoolSubmit(totals->workers, &jobs[t].task, analysisWorker, &jobs[t]);
+    }
+    analysisWorker(&jobs[0]);
+    for (long t = 1; t < threads; t++) {
+        workerPoolWait(totals->workers, &jobs[t].task);
+    }
+
+    // Keep the last pixel's samples to pair with the start of the next band
+    totals->tailLength = size < 3 ? (int)size : 3;
+    memcpy(totals->tail, pixels + size - totals->tailLength, totals->tailLength);
+    totals->samples += size;
+    return SUCCESSFUL;
+}
+
+// Merge the jobs' statistics into the running totals and turn them into the final report
+void analysisFinish(const AnalysisTotals* totals, AnalysisReport* report) {
+    AnalysisTotals merged = *totals;
+    for (int t = 0; t < totals->jobCount; t++) {
+        const AnalysisJob* job = &totals->jobs[t];
+        for (int i = 0; i < 256; i++) merged.histogram[i] += job->histogram[i];
+        for (int i = 0; i < RS_COUNTERS; i++) merged.rs[i] += job->rs[i];
+        for (int i = 0; i < SPA_COUNTERS; i++) merged.spa[i] += job->spa[i];
+        merged.mismatches += job->mismatches;
+        merged.squaredError += job->squaredError;
+    }
+    report->chiSquareProbability = chiSquareProbability(merged.histogram);
+    report->rsEstimate = rsEstimate(merged.rs);
+    report->spaEstimate = spaEstimate(merged.spa);
+    report->samples = merged.samples;
+    report->mismatches = (long)merged.mismatches;
+    report->psnr = merged.squaredError > 0 ? 10 * log10(255.0 * 255.0 * merged.samples / merged.squaredError)
+                                           : INFINITY;
+}
+
+// Run the chi-square, RS and sample pair analyses over a whole in-memory buffer
+int analyzePixels(StegoContext* context, const uint8_t* pixels, const uint8_t* cover, long size, AnalysisReport* report) {
+    AnalysisTotals totals;
+    int result = analysisBegin(&totals, &context->arena, &context->workers);
+    if (result) return result;
+    result = analyzeBand(pixels, cover, size, &totals);
+    if (result) return result;
+    analysisFinish(&totals, report);
+    return SUCCESSFUL;
+}
+
+// Size of the pixel data of a BMP file, leaving the file positioned at its start
+static long pixelDataSize(FILE* file, uint8_t* header) {
+    if (isPngFile(file)) {
+        fprintf(stderr, "Error: PNG images are only supported by -hide and -extract.\n");
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+    if (fread(header, 1, BMP_HEADER_SIZE, file) != BMP_HEADER_SIZE || checkBmpHeader(header, file) != SUCCESSFUL) {
+        fprintf(stderr, "Error: File contains no pixel data.\n");
+        return -1;
+    }
+    // Pixel data starts where the header says, past any larger info header or color masks
+    long pixelOffset = loadUint32(header + 10);
+    long size = fileSize - pixelOffset;
+    if (size <= 0 || fseek(file, pixelOffset, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: File contains no pixel data.\n");
+        return -1;
+    }
+    return size;
+}
+
+// Analyse a stego image (optionally against its cover) and decide whether it is statistically detectable.
+// Both images are streamed in bands within the context's memory budget.
+int analyzeImage(StegoContext* context, FILE* stegoFile, FILE* coverFile, int* detected) {
+    arenaReset(&context->arena);
+    uint8_t header[BMP_HEADER_SIZE];
+    long size = pixelDataSize(stegoFile, header);
+    if (size < 0) return GENERAL_ERROR;
+    if (coverFile) {
+        uint8_t coverHeader[BMP_HEADER_SIZE];
+        long coverSize = pixelDataSize(coverFile, coverHeader);
+        if (coverSize < 0) return GENERAL_ERROR;
+        if (coverSize != size) {
+            fprintf(stderr, "Error: Cover and stego images differ in size.\n");
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+    }
+
+    long bandSize = bandSizeFor(context->memoryLimit, coverFile ? 4 : 2, bmpRowStride(header));
+    BandReader stegoReader, coverReader;
+    if (!bandReaderInit(&stegoReader, &context->arena, &context->workers, stegoFile, size, bandSize)) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    if (coverFile && !bandReaderInit(&coverReader, &context->arena, &context->workers, coverFile, size, bandSize)) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        bandReaderClose(&stegoReader);
+        return GENERAL_ERROR;
+    }
+
+    AnalysisTotals totals, coverTotals;
+    int result = analysisBegin(&totals, &context->arena, &context->workers);
+    if (!result) result = analysisBegin(&coverTotals, &context->arena, &context->workers);
+    uint8_t* pixels;
+    uint8_t* cover = NULL;
+    size_t length;
+    uint64_t done = 0;
+    while (!result && (length = bandReaderNext(&stegoReader, &pixels)) > 0) {
+        if (coverFile && bandReaderNext(&coverReader, &cover) != length) {
+            fprintf(stderr, "Error: Unable to read pixel data.\n");
+            result = GENERAL_ERROR;
+            break;
+        }
+        result = analyzeBand(pixels, cover, (long)length, &totals);
+        if (!result && cover) {
+            result = analyzeBand(cover, NULL, (long)length, &coverTotals);
+        }
+        // Report once per band, which is also where a cancel request takes effect
+        done += length;
+        if (!result && stegoReportProgress(context, done, (uint64_t)size)) {
+            result = CANCELLED_ERROR;
+        }
+    }
+    bandReaderClose(&stegoReader);
+    if (coverFile) bandReaderClose(&coverReader);
+    if (result) return result;
+
+    AnalysisReport report;
+    analysisFinish(&totals, &report);
+    printf("Samples analysed       : %ld\n", report.samples);
+    printf("Chi-square probability : %.4f\n", report.chiSquareProbability);
+    printf("RS estimate            : %.4f\n", report.rsEstimate);
+    printf("Sample pair estimate   : %.4f\n", report.spaEstimate);
+
+    // Natural images have non-zero estimates of their own, so with a cover judge the increase
+    double rsRate = report.rsEstimate;
+    double spaRate = report.spaEstimate;
+    if (coverFile) {
+        AnalysisReport coverReport;
+        analysisFinish(&coverTotals, &coverReport);
+        rsRate -= coverReport.rsEstimate;
+        spaRate -= coverReport.spaEstimate;
+        printf("Cover RS estimate      : %.4f\n", coverReport.rsEstimate);
+        printf("Cover sample pair est. : %.4f\n", coverReport.spaEstimate);
+        printf("Samples changed        : %ld\n", report.mismatches);
+        printf("PSNR                   : %.2f dB\n", report.psnr);
+    }
+
+    *detected = report.chiSquareProbability >= ANALYSIS_CHI_SQUARE_THRESHOLD ||
+                rsRate > ANALYSIS_RATE_THRESHOLD || spaRate > ANALYSIS_RATE_THRESHOLD;
+    printf("Verdict                : %s\n", *detected ? "DETECTABLE" : "pass");
+    return SUCCESSFUL;
+}
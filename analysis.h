@@ -0,0 +1,64 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Output is rejected when an estimated embedding rate (or its increase over the cover) exceeds this
+#define ANALYSIS_RATE_THRESHOLD 0.10
+// ... or when the chi-square attack is at least this confident
+#define ANALYSIS_CHI_SQUARE_THRESHOLD 0.99
+// Bytes of pixel data per worker thread below which extra threads are not worth starting
+#define ANALYSIS_MIN_BYTES_PER_THREAD (1024 * 1024)
+#define ANALYSIS_MAX_THREADS 64
+
+typedef struct {
+    double chiSquareProbability; // Probability that value pairs were equalised by LSB embedding (Westfeld)
+    double rsEstimate;           // Estimated fraction of samples with a modified LSB (RS analysis)
+    double spaEstimate;          // Same estimate from sample pair analysis
+    long samples;                // Color samples analysed
+    long mismatches;             // Samples that differ from the cover (when one is given)
+    double psnr;                 // Peak signal-to-noise ratio against the cover (when one is given)
+} AnalysisReport;
+
+// RS counters: regular/singular groups under the positive and negative mask, for the image as
+// it is and with every LSB flipped
+enum { RS_RM, RS_SM, RS_RNM, RS_SNM, RS_FLIPPED, RS_COUNTERS = 8 };
+// Sample pair counters
+enum { SPA_P, SPA_W, SPA_X, SPA_Y, SPA_Z, SPA_COUNTERS };
+
+// One worker's share of each band, with the statistics it has gathered so far
+typedef struct AnalysisJob AnalysisJob;
+
+// Statistics accumulated band by band
+typedef struct {
+    uint64_t histogram[256];
+    uint64_t rs[RS_COUNTERS];
+    uint64_t spa[SPA_COUNTERS];
+    uint64_t mismatches;
+    double squaredError;
+    long samples;
+    uint8_t tail[3];   // Last pixel of the previous band, paired with the first pixel of the next
+    int tailLength;
+    WorkerPool* workers;  // Threads that take every share but the first
+    AnalysisJob* jobs;    // One per share, kept for every band and merged by analysisFinish
+    int jobCount;
+} AnalysisTotals;
+
+int analysisBegin(AnalysisTotals* totals, StegoArena* arena, WorkerPool* workers);
+int analyzeBand(const uint8_t* pixels, const uint8_t* cover, long size, AnalysisTotals* totals);
+void analysisFinish(const AnalysisTotals* totals, AnalysisReport* report);
+int analyzePixels(StegoContext* context, const uint8_t* pixels, const uint8_t* cover, long size, AnalysisReport* report);
+int analyzeImage(StegoContext* context, FILE* stegoFile, FILE* coverFile, int* detected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
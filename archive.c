@@ -0,0 +1,276 @@
+#include "archive.h"
+#include "checksum.h"
+#include "steganography.h"
+
+// Return the file name part of a path, used as the member name
+static const char* baseName(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+// Pack several files into one archive payload and hide it within a BMP file. All buffers, the
+// archive included, come from the context's arena.
+int hideArchive(StegoContext* context, const char* fileList, FILE* coverFile, FILE* outputFile, int bits_to_hide) {
+    // Split the comma separated list into individual paths
+    arenaReset(&context->arena);
+    char* paths = (char*)arenaAlloc(&context->arena, strlen(fileList) + 1);
+    if (!paths) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    strcpy(paths, fileList);
+    uint32_t count = 1;
+    for (char* p = paths; *p; p++) {
+        if (*p == ARCHIVE_LIST_SEPARATOR) {
+            *p = '\0';
+            count++;
+        }
+    }
+
+    // First pass: open every member and measure the directory and data sizes
+    FILE** members = (FILE**)arenaAlloc(&context->arena, count * sizeof(FILE*));
+    ArchiveEntry* entries = (ArchiveEntry*)arenaAlloc(&context->arena, count * sizeof(ArchiveEntry));
+    uint8_t* archive = NULL;
+    int result = SUCCESSFUL;
+    if (!members || !entries) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    memset(members, 0, count * sizeof(FILE*));
+    memset(entries, 0, count * sizeof(ArchiveEntry));
+
+    uint32_t directorySize = 0;
+    uint64_t dataSize = 0;
+    char* path = paths;
+    for (uint32_t i = 0; i < count; i++, path += strlen(path) + 1) {
+        result = fileAccessCheck(path, &members[i], READ_FILE);
+        if (result) goto cleanup;
+
+        const char* name = baseName(path);
+        size_t nameLength = strlen(name);
+        if (nameLength == 0 || nameLength > ARCHIVE_MAX_NAME) {
+            fprintf(stderr, "Error: Invalid archive member name: %s\n", path);
+            result = PARAMETERS_PROVIDED_INCORRECT_ERROR;
+            goto cleanup;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (strcmp(entries[j].name, name) == 0) {
+                fprintf(stderr, "Error: Duplicate archive member name: %s\n", name);
+                result = PARAMETERS_PROVIDED_INCORRECT_ERROR;
+                goto cleanup;
+            }
+        }
+        memcpy(entries[i].name, name, nameLength + 1);
+
+        fseek(members[i], 0, SEEK_END);
+        long size = ftell(members[i]);
+        rewind(members[i]);
+        entries[i].size = (uint32_t)size;
+        directorySize += 1 + nameLength + 12;
+        dataSize += size;
+    }
+
+    uint64_t archiveSize = ARCHIVE_HEADER_SIZE + directorySize + dataSize;
+    if (archiveSize > UINT32_MAX) {
+        fprintf(stderr, "Error: Archive members are too large.\n");
+        result = HIDE_ERROR;
+        goto cleanup;
+    }
+
+    // Allocate the whole archive inside a payload frame, checksum and terminator included
+    size_t terminatorLength = strlen(TERMINATOR_SEQUENCE);
+    long framedSize = (long)(PAYLOAD_HEADER_SIZE + archiveSize + PAYLOAD_CHECKSUM_SIZE + terminatorLength);
+    uint8_t* payload = (uint8_t*)arenaAlloc(&context->arena, framedSize);
+    if (!payload) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    archive = payload + PAYLOAD_HEADER_SIZE;
+
+    // Second pass: copy member data behind the directory and checksum it
+    uint32_t dataOffset = ARCHIVE_HEADER_SIZE + directorySize;
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].offset = dataOffset;
+        if (fread(archive + dataOffset, 1, entries[i].size, members[i]) != entries[i].size) {
+            fprintf(stderr, "Error: Unable to read archive member: %s\n", entries[i].name);
+            result = FILE_ACCESS_ERROR;
+            goto cleanup;
+        }
+        entries[i].checksum = crc32c(0, archive + dataOffset, entries[i].size);
+        dataOffset += entries[i].size;
+    }
+
+    // Write the header and directory table at the start of the payload
+    memcpy(archive, ARCHIVE_MAGIC, 4);
+    storeUint32(archive + 4, count);
+    storeUint32(archive + 8, directorySize);
+    uint8_t* entry = archive + ARCHIVE_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t nameLength = strlen(entries[i].name);
+        *entry++ = (uint8_t)nameLength;
+        memcpy(entry, entries[i].name, nameLength);
+        entry += nameLength;
+        storeUint32(entry, entries[i].offset);
+        storeUint32(entry + 4, entries[i].size);
+        storeUint32(entry + 8, entries[i].checksum);
+        entry += 12;
+    }
+
+    // Frame the archive as hideData frames a message, then hide it (the arena is not reset again)
+    memcpy(payload, PAYLOAD_MAGIC, 4);
+    storeUint32(payload + 4, (uint32_t)archiveSize);
+    memcpy(archive + archiveSize + PAYLOAD_CHECKSUM_SIZE, TERMINATOR_SEQUENCE, terminatorLength);
+    sealPayload(payload);
+    result = hideBuffer(context, payload, framedSize, coverFile, outputFile, bits_to_hide);
+
+cleanup:
+    if (members) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (members[i]) fclose(members[i]);
+        }
+    }
+    return result;
+}
+
+// Decode only the archive header and directory table from a stego file. The table and the entries
+// come from the context's arena, which the caller resets.
+int readArchiveDirectory(StegoContext* context, FILE* stegoFile, int bits_to_hide, ArchiveEntry** entries, uint32_t* count) {
+    // Check the bit depth stored in the first pixel
+    int hidden_bits_to_hide = readBitDepth(stegoFile);
+    if (hidden_bits_to_hide > 0 && (hidden_bits_to_hide & LUMA_FLAG)) {
+        fprintf(stderr, "Error: Luma stego files (--luma) are only supported by -extract.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (hidden_bits_to_hide != bits_to_hide) {
+        fprintf(stderr, "Error: Number of bits for extraction does not match the number of bits used for hiding.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+
+    // Read and validate the payload frame header and the archive header behind it
+    uint8_t header[PAYLOAD_HEADER_SIZE + ARCHIVE_HEADER_SIZE];
+    int result = readPayload(stegoFile, bits_to_hide, 0, header, sizeof(header));
+    if (result) return result;
+    if (memcmp(header, PAYLOAD_MAGIC, 4) != 0 || memcmp(header + PAYLOAD_HEADER_SIZE, ARCHIVE_MAGIC, 4) != 0) {
+        fprintf(stderr, "Error: No archive found in the stego file.\n");
+        return EXTRACT_ERROR;
+    }
+    uint32_t archiveSize = loadUint32(header + 4);
+    *count = loadUint32(header + PAYLOAD_HEADER_SIZE + 4);
+    uint32_t directorySize = loadUint32(header + PAYLOAD_HEADER_SIZE + 8);
+    // Nothing in the archive can lie past its frame, nor the frame past what the image holds, so
+    // damaged sizes are caught before they drive an allocation
+    uint64_t capacity = (uint64_t)coverCapacity(stegoFile, bits_to_hide);
+    if (PAYLOAD_HEADER_SIZE + (uint64_t)archiveSize + PAYLOAD_CHECKSUM_SIZE > capacity || *count == 0 ||
+        directorySize < (uint64_t)*count * 13 || ARCHIVE_HEADER_SIZE + (uint64_t)directorySize > archiveSize) {
+        fprintf(stderr, "Error: Archive directory is corrupt.\n");
+        return EXTRACT_ERROR;
+    }
+
+    // Read the directory table in one go
+    uint8_t* directory = (uint8_t*)arenaAlloc(&context->arena, directorySize);
+    *entries = (ArchiveEntry*)arenaAlloc(&context->arena, (size_t)*count * sizeof(ArchiveEntry));
+    if (!directory || !*entries) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        *entries = NULL;
+        return GENERAL_ERROR;
+    }
+    result = readPayload(stegoFile, bits_to_hide, PAYLOAD_HEADER_SIZE + ARCHIVE_HEADER_SIZE, directory, directorySize);
+
+    // Decode each entry, checking it stays inside the table
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < *count && !result; i++) {
+        uint8_t nameLength = directory[position];
+        if (nameLength == 0 || position + 1 + nameLength + 12 > directorySize) {
+            fprintf(stderr, "Error: Archive directory is corrupt.\n");
+            result = EXTRACT_ERROR;
+            break;
+        }
+        memcpy((*entries)[i].name, directory + position + 1, nameLength);
+        (*entries)[i].name[nameLength] = '\0';
+        position += 1 + nameLength;
+        (*entries)[i].offset = loadUint32(directory + position);
+        (*entries)[i].size = loadUint32(directory + position + 4);
+        (*entries)[i].checksum = loadUint32(directory + position + 8);
+        position += 12;
+        if ((uint64_t)(*entries)[i].offset + (*entries)[i].size > archiveSize) {
+            fprintf(stderr, "Error: Archive member extends past the end of the archive: %s\n", (*entries)[i].name);
+            result = EXTRACT_ERROR;
+        }
+    }
+
+    if (result) {
+        *entries = NULL;
+    }
+    return result;
+}
+
+// Print the archive directory of a stego file
+int listArchive(StegoContext* context, FILE* stegoFile, int bits_to_hide) {
+    ArchiveEntry* entries = NULL;
+    uint32_t count = 0;
+    arenaReset(&context->arena);
+    int result = readArchiveDirectory(context, stegoFile, bits_to_hide, &entries, &count);
+    if (result) return result;
+
+    printf("%-10s %-10s %s\n", "Size", "CRC32C", "Name");
+    for (uint32_t i = 0; i < count; i++) {
+        printf("%-10u %08x   %s\n", entries[i].size, entries[i].checksum, entries[i].name);
+    }
+    return SUCCESSFUL;
+}
+
+// Extract a single archive member, decoding only the pixel groups that hold it
+int extractArchiveMember(StegoContext* context, FILE* stegoFile, int bits_to_hide, const char* name, FILE* outputFile) {
+    ArchiveEntry* entries = NULL;
+    uint32_t count = 0;
+    arenaReset(&context->arena);
+    int result = readArchiveDirectory(context, stegoFile, bits_to_hide, &entries, &count);
+    if (result) return result;
+
+    // Find the requested member in the directory
+    ArchiveEntry* member = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            member = &entries[i];
+            break;
+        }
+    }
+    if (!member) {
+        fprintf(stderr, "Error: Archive member not found: %s\n", name);
+        return EXTRACT_ERROR;
+    }
+
+    uint8_t* data = (uint8_t*)arenaAlloc(&context->arena, member->size ? member->size : 1);
+    if (!data) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+
+    // Decode the member block by block, which is also where a cancel request takes effect, and
+    // verify its checksum before writing it out
+    for (uint32_t done = 0; done < member->size && !result;) {
+        uint32_t block = member->size - done < PAYLOAD_READ_BLOCK ? member->size - done : PAYLOAD_READ_BLOCK;
+        result = readPayload(stegoFile, bits_to_hide, PAYLOAD_HEADER_SIZE + (long)member->offset + done, data + done, block);
+        done += block;
+        if (!result && stegoReportProgress(context, done, member->size)) {
+            result = CANCELLED_ERROR;
+        }
+    }
+    if (!result && crc32c(0, data, member->size) != member->checksum) {
+        fprintf(stderr, "Error: Checksum mismatch for archive member: %s\n", name);
+        result = EXTRACT_ERROR;
+    }
+    if (!result) {
+        fwrite(data, 1, member->size, outputFile);
+    }
+
+    // The directory and member data stay in the arena for the next call
+    return result;
+}
@@ -0,0 +1,41 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Archive payload layout (all integers little-endian):
+//   "SARC" | uint32 member count | uint32 directory size
+//   directory entries: uint8 name length | name | uint32 offset | uint32 size | uint32 crc32c
+//   member data, back to back
+// Offsets are relative to the start of the archive. The archive is hidden in the same frame as a
+// -hide payload (magic, length, data, CRC32C, terminator), so -extract returns it whole and
+// verified, and -list/-member find it at PAYLOAD_HEADER_SIZE into the payload.
+#define ARCHIVE_MAGIC "SARC"
+#define ARCHIVE_HEADER_SIZE 12
+#define ARCHIVE_MAX_NAME 255
+#define ARCHIVE_LIST_SEPARATOR ','
+
+typedef struct {
+    char name[ARCHIVE_MAX_NAME + 1];
+    uint32_t offset;
+    uint32_t size;
+    uint32_t checksum;
+} ArchiveEntry;
+
+int hideArchive(StegoContext* context, const char* fileList, FILE* coverFile, FILE* outputFile, int bits_to_hide);
+int readArchiveDirectory(StegoContext* context, FILE* stegoFile, int bits_to_hide, ArchiveEntry** entries, uint32_t* count);
+int listArchive(StegoContext* context, FILE* stegoFile, int bits_to_hide);
+int extractArchiveMember(StegoContext* context, FILE* stegoFile, int bits_to_hide, const char* name, FILE* outputFile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t capacity;    // Usable bytes after the block header
+    size_t used;
+    size_t total;       // Bytes obtained from the system, header included
+    int mapped;         // Obtained with mmap rather than malloc
+};
+
+// Header size rounded up so allocations stay aligned
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+// Round a size up to the allocation alignment
+static size_t alignSize(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Obtain a new block from the system, preferring huge pages for large blocks
+static ArenaBlock* newBlock(StegoArena* arena, size_t capacity) {
+    size_t total = ARENA_HEADER_SIZE + capacity;
+    ArenaBlock* block = NULL;
+    int mapped = 0;
+
+#if !defined(_WIN32) && defined(MAP_ANONYMOUS)
+    if (arena->hugePages && total >= ARENA_HUGE_PAGE_SIZE) {
+        // Round up to whole huge pages and try explicit huge pages first, then transparent ones
+        total = (total + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+        void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (memory == MAP_FAILED) {
+            memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (memory != MAP_FAILED) {
+                madvise(memory, total, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (memory != MAP_FAILED) {
+            block = (ArenaBlock*)memory;
+            mapped = 1;
+        }
+    }
+#endif
+
+    if (!block) {
+        block = (ArenaBlock*)malloc(total);
+        if (!block) {
+            return NULL;
+        }
+    }
+    block->next = NULL;
+    block->capacity = total - ARENA_HEADER_SIZE;
+    block->used = 0;
+    block->total = total;
+    block->mapped = mapped;
+    arena->blockAllocations++;
+    return block;
+}
+
+// Return a block to the system
+static void freeBlock(ArenaBlock* block) {
+#if !defined(_WIN32) && defined(MAP_ANONYMOUS)
+    if (block->mapped) {
+        munmap(block, block->total);
+        return;
+    }
+#endif
+    free(block);
+}
+
+// Bytes in use across all blocks
+static size_t arenaUsed(const StegoArena* arena) {
+    size_t used = 0;
+    for (ArenaBlock* block = arena->head; block; block = block->next) {
+        used += block->used;
+    }
+    return used;
+}
+
+// Prepare an empty arena; no memory is reserved until the first allocation
+void arenaInit(StegoArena* arena, int hugePages) {
+    memset(arena, 0, sizeof(*arena));
+    arena->hugePages = hugePages;
+}
+
+// Allocate aligned scratch memory that lives until the next arenaReset
+void* arenaAlloc(StegoArena* arena, size_t size) {
+    size = alignSize(size ? size : 1);
+    ArenaBlock* block = arena->head;
+    if (!block || block->capacity - block->used < size) {
+        // Start a new block at least twice as large as the current one to keep the chain short
+        size_t capacity = block ? block->capacity * 2 : ARENA_MIN_BLOCK;
+        if (capacity < size) capacity = size;
+        ArenaBlock* fresh = newBlock(arena, capacity);
+        if (!fresh) {
+            return NULL;
+        }
+        fresh->next = block;
+        arena->head = fresh;
+        block = fresh;
+    }
+    void* pointer = (uint8_t*)block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    arena->last = pointer;
+    return pointer;
+}
+
+// Resize an allocation, extending it in place when it is the most recent one and the block has room
+void* arenaGrow(StegoArena* arena, void* pointer, size_t oldSize, size_t newSize) {
+    ArenaBlock* block = arena->head;
+    if (pointer && pointer == arena->last && block) {
+        size_t offset = (size_t)((uint8_t*)pointer - ((uint8_t*)block + ARENA_HEADER_SIZE));
+        if (alignSize(newSize) <= block->capacity - offset) {
+            block->used = offset + alignSize(newSize);
+            return pointer;
+        }
+    }
+    void* grown = arenaAlloc(arena, newSize);
+    if (grown && pointer) {
+        memcpy(grown, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+    return grown;
+}
+
+// Release every allocation at once; a chain of blocks is replaced by one block that fits it all
+void arenaReset(StegoArena* arena) {
+    size_t used = arenaUsed(arena);
+    if (used > arena->peak) {
+        arena->peak = used;
+    }
+    if (arena->head && arena->head->next) {
+        arenaRelease(arena);
+        arena->head = newBlock(arena, alignSize(arena->peak));
+    }
+    if (arena->head) {
+        arena->head->used = 0;
+    }
+    arena->last = NULL;
+}
+
+// Return all memory held by the arena to the system
+void arenaRelease(StegoArena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        freeBlock(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->last = NULL;
+}
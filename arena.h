@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blocks at least this large are backed by huge pages when the arena allows it
+#define ARENA_HUGE_PAGE_SIZE (2u * 1024 * 1024)
+#define ARENA_ALIGNMENT 64
+#define ARENA_MIN_BLOCK (64u * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator for per-call scratch memory. Everything is released at once by arenaReset, which
+// also folds all blocks into a single one big enough for the last run, so a repeated workload
+// reaches a steady state where it makes no heap allocations at all.
+typedef struct {
+    ArenaBlock* head;               // Block currently allocated from (newest first)
+    size_t peak;                    // Bytes used by the largest run since the last consolidation
+    int hugePages;                  // Back large blocks with huge pages when possible
+    void* last;                     // Most recent allocation, which arenaGrow can extend in place
+    unsigned long blockAllocations; // Number of blocks obtained from the system so far
+} StegoArena;
+
+void arenaInit(StegoArena* arena, int hugePages);
+void* arenaAlloc(StegoArena* arena, size_t size);
+void* arenaGrow(StegoArena* arena, void* pointer, size_t oldSize, size_t newSize);
+void arenaReset(StegoArena* arena);
+void arenaRelease(StegoArena* arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,383 @@
+#include "bench.h"
+#include "pngcodec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// One cover shape of the suite, with its format and an optional global option; every shape runs at
+// each bit depth
+typedef struct {
+    const char* name;
+    int32_t width;
+    int32_t height;
+    int pattern;
+    int png;             // Written as a PNG instead of a BMP
+    const char* option;  // Passed before the command, e.g. --luma
+} BenchCase;
+
+// Widths cover every amount of row padding (0, 1, 2 and 3 bytes); the last cases time the PNG codec
+// and the --luma and --constant-time kernels
+static const BenchCase benchCases[] = {
+    { "gradient-2048x1536", 2048, 1536, BENCH_GRADIENT, 0, NULL },
+    { "noise-2045x1535", 2045, 1535, BENCH_NOISE, 0, NULL },
+    { "saturated-1998x1201", 1998, 1201, BENCH_SATURATED, 0, NULL },
+    { "column-7x200000", 7, 200000, BENCH_NOISE, 0, NULL },
+    { "png-gradient-1536x1024", 1536, 1024, BENCH_GRADIENT, 1, NULL },
+    { "luma-noise-2045x1535", 2045, 1535, BENCH_NOISE, 0, "--luma" },
+    { "consttime-saturated-1998x1201", 1998, 1201, BENCH_SATURATED, 0, "--constant-time" },
+};
+#define BENCH_CASE_COUNT (sizeof(benchCases) / sizeof(benchCases[0]))
+#define BENCH_MAX_RESULTS (BENCH_CASE_COUNT * 4)
+
+// Measured (or stored) throughput of one shape at one bit depth, in MB of cover per second
+typedef struct {
+    char name[64];
+    double hide;
+    double extract;
+} BenchResult;
+
+// Small deterministic generator so the same seed gives the same files on every platform
+static uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double secondsNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Fill one row of BGR (or RGB, the patterns do not care) pixels of a generated cover
+static void generateRow(uint8_t* row, int32_t width, int32_t height, int32_t y, int pattern, uint32_t* state) {
+    int32_t spanX = width > 1 ? width - 1 : 1;
+    int32_t spanY = height > 1 ? height - 1 : 1;
+    for (int32_t x = 0; x < width; x++) {
+        uint8_t* pixel = row + (size_t)x * 3;
+        if (pattern == BENCH_GRADIENT) {
+            pixel[0] = (uint8_t)(x * 255 / spanX);
+            pixel[1] = (uint8_t)(y * 255 / spanY);
+            pixel[2] = (uint8_t)(((int64_t)x + y) * 255 / (spanX + spanY));
+        } else if (pattern == BENCH_SATURATED && ((x / 32 + y / 32) % 3) != 2) {
+            memset(pixel, ((x / 32 + y / 32) % 3) ? 255 : 0, 3);
+        } else {
+            uint32_t value = nextRandom(state);
+            pixel[0] = (uint8_t)value;
+            pixel[1] = (uint8_t)(value >> 8);
+            pixel[2] = (uint8_t)(value >> 16);
+        }
+    }
+}
+
+// Write a 24-bit BMP of the given size and contents; rows are padded to 4 bytes as the format requires
+int generateCover(FILE* file, int32_t width, int32_t height, int pattern, uint32_t seed) {
+    uint32_t stride = ((uint32_t)width * 3 + 3) & ~3u;
+    uint32_t imageSize = stride * (uint32_t)height;
+    uint8_t header[BMP_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    storeUint32(header + 2, BMP_HEADER_SIZE + imageSize);  // File size
+    storeUint32(header + 10, BMP_HEADER_SIZE);             // Pixel data offset
+    storeUint32(header + 14, 40);                          // BITMAPINFOHEADER
+    storeUint32(header + 18, (uint32_t)width);
+    storeUint32(header + 22, (uint32_t)height);
+    header[26] = 1;                                        // Planes
+    header[28] = 24;                                       // Bits per pixel
+    storeUint32(header + 34, imageSize);
+    storeUint32(header + 38, 2835);                        // 72 DPI
+    storeUint32(header + 42, 2835);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        return FILE_ACCESS_ERROR;
+    }
+
+    uint8_t* row = (uint8_t*)calloc(stride, 1);
+    if (!row) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    uint32_t state = seed ? seed : 1;  // xorshift never leaves 0
+    int result = SUCCESSFUL;
+    for (int32_t y = 0; y < height && result == SUCCESSFUL; y++) {
+        generateRow(row, width, height, y, pattern, &state);
+        if (fwrite(row, 1, stride, file) != stride) {
+            result = FILE_ACCESS_ERROR;
+        }
+    }
+    free(row);
+    return result;
+}
+
+// Write an 8-bit RGB PNG with the same contents generateCover would give a BMP
+int generatePngCover(StegoContext* context, FILE* file, int32_t width, int32_t height, int pattern, uint32_t seed) {
+    arenaReset(&context->arena);
+    uint8_t* row = (uint8_t*)arenaAlloc(&context->arena, (size_t)width * 3);
+    if (!row) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    PngWriter writer;
+    int result = pngWriterOpen(&writer, &context->arena, &context->workers, file, (uint32_t)width, (uint32_t)height,
+                               context->pngLevel);
+    if (result) return result;
+    uint32_t state = seed ? seed : 1;
+    for (int32_t y = 0; y < height && result == SUCCESSFUL; y++) {
+        generateRow(row, width, height, y, pattern, &state);
+        result = pngWriterWrite(&writer, row, (size_t)width * 3);
+    }
+    int closeResult = pngWriterClose(&writer, NULL);
+    return result ? result : closeResult;
+}
+
+// Write length bytes of deterministic random data
+int generatePayload(FILE* file, long length, uint32_t seed) {
+    uint32_t state = seed ? seed : 1;
+    for (long i = 0; i < length; i++) {
+        if (fputc((int)(nextRandom(&state) & 0xFF), file) == EOF) {
+            return FILE_ACCESS_ERROR;
+        }
+    }
+    return SUCCESSFUL;
+}
+
+// Compare two files byte for byte
+static int sameContents(const char* firstPath, const char* secondPath) {
+    FILE* first = fopen(firstPath, "rb");
+    FILE* second = fopen(secondPath, "rb");
+    int same = first && second;
+    while (same) {
+        int a = fgetc(first);
+        int b = fgetc(second);
+        if (a != b) same = 0;
+        if (a == EOF) break;
+    }
+    if (first) fclose(first);
+    if (second) fclose(second);
+    return same;
+}
+
+// Run the program as a separate process, so process startup, argument parsing and the output file's
+// temporary name and rename are all timed. The context's --mem-limit and --png-level and the case's
+// option come before the command; the program's own messages are discarded. Returns its exit status.
+static int timedRun(const char* program, const StegoContext* context, const char* option, const char* const command[],
+                    double* seconds) {
+    char memoryLimit[32], pngLevel[16];
+    snprintf(memoryLimit, sizeof(memoryLimit), "%zu", context->memoryLimit);
+    snprintf(pngLevel, sizeof(pngLevel), "%d", context->pngLevel);
+    const char* arguments[BENCH_MAX_ARGUMENTS];
+    int count = 0;
+    arguments[count++] = program;
+    arguments[count++] = "--mem-limit";
+    arguments[count++] = memoryLimit;
+    arguments[count++] = "--png-level";
+    arguments[count++] = pngLevel;
+    if (option) arguments[count++] = option;
+    for (int i = 0; command[i] && count < BENCH_MAX_ARGUMENTS - 1; i++) {
+        arguments[count++] = command[i];
+    }
+    arguments[count] = NULL;
+
+    double start = secondsNow();
+    pid_t child = fork();
+    if (child < 0) {
+        fprintf(stderr, "Error: Unable to start %s\n", program);
+        return GENERAL_ERROR;
+    }
+    if (child == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) dup2(devNull, STDOUT_FILENO);
+        execvp(program, (char* const*)arguments);
+        fprintf(stderr, "Error: Unable to run %s\n", program);
+        _exit(GENERAL_ERROR);
+    }
+    int status;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) return GENERAL_ERROR;
+    }
+    *seconds = secondsNow() - start;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : GENERAL_ERROR;
+}
+
+// Read a baseline written by an earlier run: one "name hide extract" line per case, '#' starts a comment
+static int loadBaseline(const char* path, BenchResult* baseline) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    int count = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) && count < (int)BENCH_MAX_RESULTS) {
+        if (line[0] == '#') continue;
+        BenchResult* entry = &baseline[count];
+        if (sscanf(line, "%63s %lf %lf", entry->name, &entry->hide, &entry->extract) == 3) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static const BenchResult* findBaseline(const BenchResult* baseline, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(baseline[i].name, name) == 0) return &baseline[i];
+    }
+    return NULL;
+}
+
+// Percentage change of a measurement against its baseline, for the report
+static double percentChange(double now, double before) {
+    return before > 0 ? (now - before) * 100.0 / before : 0.0;
+}
+
+// Generate every cover shape, time the program's -hide and -extract end to end at bits 1-4, check
+// that the message comes back intact, and compare throughput with the baseline file when there is
+// one. Without a baseline the measurements are written to baselinePath for later runs to compare
+// against; a baseline without measurements, or without one of the cases, fails the check.
+int runBenchmark(StegoContext* context, const char* program, const char* workDirectory, const char* baselinePath) {
+    struct stat info;
+    if (stat(workDirectory, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        fprintf(stderr, "Error: Not a directory: %s\n", workDirectory);
+        return FILE_ACCESS_ERROR;
+    }
+
+    BenchResult baseline[BENCH_MAX_RESULTS];
+    int baselineCount = baselinePath ? loadBaseline(baselinePath, baseline) : -1;
+    if (baselineCount == 0) {
+        fprintf(stderr, "Error: Baseline file has no measurements: %s\n", baselinePath);
+        return REGRESSION_ERROR;
+    }
+    BenchResult results[BENCH_MAX_RESULTS];
+    int resultCount = 0;
+    int failures = 0;
+    int regressions = 0;
+    int missing = 0;
+
+    printf("%-*s %12s %12s\n", BENCH_NAME_WIDTH, "case", "hide MB/s", "extract MB/s");
+    for (size_t c = 0; c < BENCH_CASE_COUNT; c++) {
+        const BenchCase* shape = &benchCases[c];
+        const char* extension = shape->png ? "png" : "bmp";
+        char coverPath[4096];
+        snprintf(coverPath, sizeof(coverPath), "%s/%s.%s", workDirectory, shape->name, extension);
+        FILE* coverFile = fopen(coverPath, "wb+");
+        if (!coverFile) {
+            fprintf(stderr, "Error: Unable to create or write to the file: %s\n", coverPath);
+            return FILE_ACCESS_ERROR;
+        }
+        int result = shape->png
+                         ? generatePngCover(context, coverFile, shape->width, shape->height, shape->pattern, (uint32_t)c + 1)
+                         : generateCover(coverFile, shape->width, shape->height, shape->pattern, (uint32_t)c + 1);
+        // Throughput is measured against the raw pixel data, which a PNG holds compressed
+        long coverSize = shape->png ? (long)shape->width * shape->height * 3 : ftell(coverFile);
+        long capacity[5];
+        for (int bits = 1; bits <= 4; bits++) {
+            // A PNG has no row padding: its groups follow the first pixel of the flat RGB rows
+            capacity[bits] = shape->png ? (coverSize - 3) / (4 * 3) * 3 * bits / 8 : coverCapacity(coverFile, bits);
+        }
+        if (fclose(coverFile) != 0 || result) {
+            fprintf(stderr, "Error: Unable to generate cover: %s\n", coverPath);
+            return result ? result : FILE_ACCESS_ERROR;
+        }
+
+        for (int bits = 1; bits <= 4; bits++) {
+            BenchResult* entry = &results[resultCount++];
+            snprintf(entry->name, sizeof(entry->name), "%s-b%d", shape->name, bits);
+            char payloadPath[4096], stegoPath[4096], outputPath[4096], bitsText[16];
+            snprintf(payloadPath, sizeof(payloadPath), "%s/%s.bin", workDirectory, entry->name);
+            snprintf(stegoPath, sizeof(stegoPath), "%s/%s-stego.%s", workDirectory, entry->name, extension);
+            snprintf(outputPath, sizeof(outputPath), "%s/%s-out.bin", workDirectory, entry->name);
+
+            // The payload fills most of the cover, leaving room for the frame and terminator
+            long overhead = PAYLOAD_HEADER_SIZE + PAYLOAD_CHECKSUM_SIZE + (long)strlen(TERMINATOR_SEQUENCE);
+            long length = (capacity[bits] - overhead) * BENCH_FILL_PERCENT / 100;
+            FILE* payloadFile = fopen(payloadPath, "wb");
+            result = payloadFile ? generatePayload(payloadFile, length, (uint32_t)(c * 4 + bits) * 2654435761u)
+                                 : FILE_ACCESS_ERROR;
+            if (payloadFile && fclose(payloadFile) != 0) result = FILE_ACCESS_ERROR;
+            if (result) {
+                fprintf(stderr, "Error: Unable to generate payload: %s\n", payloadPath);
+                return result;
+            }
+
+            // Keep the fastest of the repeats; every repeat must round-trip
+            snprintf(bitsText, sizeof(bitsText), "%d", bits);
+            const char* const hide[] = { "-hide", "-m", payloadPath, "-c", coverPath, "-b", bitsText, "-o", stegoPath, NULL };
+            const char* const extract[] = { "-extract", "-s", stegoPath, "-b", bitsText, "-o", outputPath, NULL };
+            double bestHide = 0, bestExtract = 0;
+            for (int repeat = 0; repeat < BENCH_REPEATS && result == SUCCESSFUL; repeat++) {
+                double seconds;
+                result = timedRun(program, context, shape->option, hide, &seconds);
+                if (result) break;
+                if (repeat == 0 || seconds < bestHide) bestHide = seconds;
+                result = timedRun(program, context, shape->option, extract, &seconds);
+                if (result) break;
+                if (repeat == 0 || seconds < bestExtract) bestExtract = seconds;
+                if (!sameContents(payloadPath, outputPath)) result = INTEGRITY_ERROR;
+            }
+            if (result) {
+                printf("%-*s FAILED [Error %d]\n", BENCH_NAME_WIDTH, entry->name, result);
+                entry->hide = entry->extract = 0;
+                failures++;
+                continue;
+            }
+            remove(stegoPath);
+            remove(outputPath);
+
+            double megabytes = (double)coverSize / (1024.0 * 1024.0);
+            entry->hide = megabytes / (bestHide > 0 ? bestHide : 1e-9);
+            entry->extract = megabytes / (bestExtract > 0 ? bestExtract : 1e-9);
+            printf("%-*s %12.1f %12.1f", BENCH_NAME_WIDTH, entry->name, entry->hide, entry->extract);
+
+            // A drop beyond the tolerance in either hide or extract throughput is a regression, and a
+            // case the baseline does not know cannot be judged
+            const BenchResult* before = baselineCount > 0 ? findBaseline(baseline, baselineCount, entry->name) : NULL;
+            if (baselineCount > 0 && !before) {
+                printf("   NOT IN BASELINE");
+                missing++;
+            } else if (before) {
+                double floor = 1.0 - BENCH_TOLERANCE_PERCENT / 100.0;
+                int slower = entry->hide < before->hide * floor || entry->extract < before->extract * floor;
+                printf("   %+6.1f%% %+6.1f%%%s", percentChange(entry->hide, before->hide),
+                       percentChange(entry->extract, before->extract), slower ? "   REGRESSION" : "");
+                regressions += slower;
+            }
+            printf("\n");
+        }
+    }
+
+    // The first run on a machine records its numbers instead of judging them
+    if (baselinePath && baselineCount < 0 && failures == 0) {
+        FILE* file = fopen(baselinePath, "w");
+        if (!file) {
+            fprintf(stderr, "Error: Unable to create or write to the file: %s\n", baselinePath);
+            return FILE_ACCESS_ERROR;
+        }
+        fprintf(file, "# case hide_MBps extract_MBps\n");
+        for (int i = 0; i < resultCount; i++) {
+            fprintf(file, "%s %.2f %.2f\n", results[i].name, results[i].hide, results[i].extract);
+        }
+        fclose(file);
+        printf("Baseline written to %s.\n", baselinePath);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d case(s) did not round-trip.\n", failures);
+        return INTEGRITY_ERROR;
+    }
+    if (missing) {
+        fprintf(stderr, "%d case(s) are missing from the baseline; delete it to record a new one.\n", missing);
+    }
+    if (regressions) {
+        fprintf(stderr, "%d case(s) are more than %d%% slower than the baseline.\n", regressions,
+                BENCH_TOLERANCE_PERCENT);
+    }
+    if (missing || regressions) {
+        return REGRESSION_ERROR;
+    }
+    printf("All %d cases round-tripped.\n", resultCount);
+    return SUCCESSFUL;
+}
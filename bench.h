@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cover contents produced by the generator
+#define BENCH_GRADIENT 0   // Smooth ramps, like skies and out-of-focus backgrounds
+#define BENCH_NOISE 1      // Uniform random bytes
+#define BENCH_SATURATED 2  // Blocks of pure black and white over noise, which push the kernel to its clamps
+
+// Timed runs per case; the fastest one counts, so a busy machine shows up as noise rather than a regression
+#define BENCH_REPEATS 5
+// A case fails when its throughput falls more than this far below the baseline
+#define BENCH_TOLERANCE_PERCENT 20
+// Share of the cover's capacity filled by the generated payload
+#define BENCH_FILL_PERCENT 90
+// Arguments passed to one timed run of the program, with room for the global options
+#define BENCH_MAX_ARGUMENTS 24
+// Width of the case column in the report
+#define BENCH_NAME_WIDTH 34
+
+int generateCover(FILE* file, int32_t width, int32_t height, int pattern, uint32_t seed);
+int generatePngCover(StegoContext* context, FILE* file, int32_t width, int32_t height, int pattern, uint32_t seed);
+int generatePayload(FILE* file, long length, uint32_t seed);
+int runBenchmark(StegoContext* context, const char* program, const char* workDirectory, const char* baselinePath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
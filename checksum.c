@@ -0,0 +1,103 @@
+#include "checksum.h"
+#include <string.h>
+#include <pthread.h>
+
+// Reflected CRC32C polynomial
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE_X86 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HARDWARE_ARM 1
+#endif
+
+static uint32_t crcTable[256];
+// Checksums are computed on several threads at once (shards), so the table is built exactly once
+static pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT;
+
+// Build the byte-wise lookup table on first use
+static void buildCrcTable(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+        }
+        crcTable[i] = crc;
+    }
+}
+
+// Portable table-driven implementation
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* data, size_t length) {
+    pthread_once(&crcTableOnce, buildCrcTable);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ crcTable[(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+#if defined(CRC32C_HARDWARE_X86)
+// SSE4.2 crc32 instruction, 8 bytes per step on 64-bit builds
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    uint64_t wide = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+#else
+    for (; length >= 4; data += 4, length -= 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; length > 0; data++, length--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return ~crc;
+}
+#elif defined(CRC32C_HARDWARE_ARM)
+// ARMv8 CRC32 extension, 8 bytes per step
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; length > 0; data++, length--) {
+        crc = __crc32cb(crc, *data);
+    }
+    return ~crc;
+}
+#endif
+
+#if defined(CRC32C_HARDWARE_X86)
+static int hardwareSupport = 0;
+static pthread_once_t hardwareSupportOnce = PTHREAD_ONCE_INIT;
+
+// Ask the CPU once whether it has the crc32 instruction
+static void detectHardwareSupport(void) {
+    hardwareSupport = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+}
+#endif
+
+// Update a running CRC32C checksum with the given bytes, using the CPU's crc32 instruction when available
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length) {
+#if defined(CRC32C_HARDWARE_X86)
+    pthread_once(&hardwareSupportOnce, detectHardwareSupport);
+    if (hardwareSupport) {
+        return crc32cHardware(crc, data, length);
+    }
+#elif defined(CRC32C_HARDWARE_ARM)
+    return crc32cHardware(crc, data, length);
+#endif
+    return crc32cSoftware(crc, data, length);
+}
@@ -0,0 +1,18 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Update a running CRC32C (Castagnoli) checksum; start with 0
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,93 @@
+// Differential target for the embedding kernels: the table-driven distributeAverage and the
+// constant-time distributeAverageConstantTime must both match a plain reference written from the
+// definition, pixel for pixel, and the group must then carry the wanted bits.
+//
+// Build from the repository root with libFuzzer:
+//   clang -O1 -g -fsanitize=fuzzer,address,undefined -I. -o fuzz_kernels fuzz/fuzz_kernels.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./fuzz_kernels
+// or with gcc and the stand-in driver (random inputs):
+//   gcc -O1 -g -fsanitize=address,undefined -I. -o fuzz_kernels fuzz/fuzz_kernels.c fuzz/fuzz_main.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./fuzz_kernels
+
+#include "steganography.h"
+
+// Input bytes per case: 4 pixels, then the bit depth and the 3 wanted values
+#define KERNEL_CASE_SIZE 16
+
+// The kernels' definition, one step at a time: each component sum moves to the nearest sum in
+// [0, 1020] whose average ends in the wanted bits (the higher one on a tie), and the 4 pixels take
+// turns moving by one, skipping those already at 0 or 255
+static void referenceDistribute(uint8_t* avg, uint8_t* pixels, int bits_to_hide, const uint8_t* bits) {
+    int mask = (1 << bits_to_hide) - 1;
+    for (int c = 0; c < 3; c++) {
+        int sum = pixels[c] + pixels[c + 3] + pixels[c + 6] + pixels[c + 9];
+        int target = sum;
+        for (int d = 0; d <= 4 * 255; d++) {
+            if (sum + d <= 4 * 255 && ((sum + d) / 4 & mask) == bits[c]) {
+                target = sum + d;
+                break;
+            }
+            if (sum - d >= 0 && ((sum - d) / 4 & mask) == bits[c]) {
+                target = sum - d;
+                break;
+            }
+        }
+        avg[c] = (uint8_t)(target / 4);
+
+        int step = target > sum ? 1 : -1;
+        for (int i = 0; sum != target; i = (i + 1) % 4) {
+            int value = pixels[c + 3 * i] + step;
+            if (value >= 0 && value <= 255) {
+                pixels[c + 3 * i] = (uint8_t)value;
+                sum += step;
+            }
+        }
+    }
+}
+
+// Print a failing case and stop, so the fuzzer keeps the input
+static void reportMismatch(const char* kernel, const uint8_t* input, const uint8_t* expected, const uint8_t* actual) {
+    fprintf(stderr, "fuzz_kernels: %s differs from the reference\n  input   ", kernel);
+    for (int i = 0; i < KERNEL_CASE_SIZE; i++) fprintf(stderr, " %3u", input[i]);
+    fprintf(stderr, "\n  expected");
+    for (int i = 0; i < 4 * 3; i++) fprintf(stderr, " %3u", expected[i]);
+    fprintf(stderr, "\n  actual  ");
+    for (int i = 0; i < 4 * 3; i++) fprintf(stderr, " %3u", actual[i]);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    for (size_t offset = 0; offset + KERNEL_CASE_SIZE <= size; offset += KERNEL_CASE_SIZE) {
+        const uint8_t* input = data + offset;
+        int bits_to_hide = 1 + (input[12] & 3);
+        uint8_t bits[3];
+        for (int c = 0; c < 3; c++) {
+            bits[c] = input[13 + c] & ((1 << bits_to_hide) - 1);
+        }
+
+        uint8_t expected[4 * 3], fast[4 * 3], constant[4 * 3];
+        uint8_t expectedAvg[3], fastAvg[3], constantAvg[3];
+        memcpy(expected, input, sizeof(expected));
+        memcpy(fast, input, sizeof(fast));
+        memcpy(constant, input, sizeof(constant));
+        referenceDistribute(expectedAvg, expected, bits_to_hide, bits);
+        distributeAverage(fastAvg, fast, bits_to_hide, bits);
+        distributeAverageConstantTime(constantAvg, constant, bits_to_hide, bits);
+
+        if (memcmp(fast, expected, sizeof(expected)) != 0 || memcmp(fastAvg, expectedAvg, 3) != 0) {
+            reportMismatch("distributeAverage", input, expected, fast);
+        }
+        if (memcmp(constant, expected, sizeof(expected)) != 0 || memcmp(constantAvg, expectedAvg, 3) != 0) {
+            reportMismatch("distributeAverageConstantTime", input, expected, constant);
+        }
+
+        // Extraction must read the wanted bits back
+        uint8_t avg[3];
+        averageColors(avg, expected);
+        for (int c = 0; c < 3; c++) {
+            if (extractBits(avg[c], bits_to_hide) != bits[c]) {
+                reportMismatch("extraction", input, expected, expected);
+            }
+        }
+    }
+    return 0;
+}
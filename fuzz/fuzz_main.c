@@ -0,0 +1,71 @@
+// Stand-in for the libFuzzer driver, so the fuzz targets also build and run with gcc. Each argument
+// is a seed file: it is fed to the target as is and then in FUZZ_MUTATIONS mutated copies (bytes
+// overwritten, the tail cut off). With no arguments pseudo-random inputs are generated instead. Link
+// it with one target, e.g.
+//   gcc -O1 -g -fsanitize=address,undefined -I. -o fuzz_header fuzz/fuzz_header.c fuzz/fuzz_main.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./fuzz_header test/parrots.bmp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mutated copies tried per seed file, random inputs tried without one, and their sizes
+#define FUZZ_MUTATIONS 2000
+#define FUZZ_RANDOM_RUNS 20000
+#define FUZZ_RANDOM_MAX 4096
+#define FUZZ_MAX_INPUT (4 * 1024 * 1024)
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+// Fixed seed, so a failure found here repeats on the next run
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom(void) {
+    randomState = randomState * 1103515245u + 12345u;
+    return randomState >> 8;
+}
+
+int main(int argc, char* argv[]) {
+    uint8_t* seed = (uint8_t*)malloc(FUZZ_MAX_INPUT);
+    uint8_t* input = (uint8_t*)malloc(FUZZ_MAX_INPUT);
+    if (!seed || !input) {
+        fprintf(stderr, "fuzz: memory allocation failed\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE* file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "fuzz: unable to open %s\n", argv[i]);
+            return 1;
+        }
+        size_t size = fread(seed, 1, FUZZ_MAX_INPUT, file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(seed, size);
+
+        // Mutations mostly land in the first bytes, where the headers are
+        for (int run = 0; run < FUZZ_MUTATIONS && size > 0; run++) {
+            memcpy(input, seed, size);
+            size_t length = nextRandom() % 4 == 0 ? nextRandom() % size : size;
+            for (int changes = 1 + nextRandom() % 8; changes > 0 && length > 0; changes--) {
+                size_t limit = nextRandom() % 2 ? (length < 256 ? length : 256) : length;
+                input[nextRandom() % limit] = (uint8_t)nextRandom();
+            }
+            LLVMFuzzerTestOneInput(input, length);
+        }
+    }
+
+    if (argc == 1) {
+        for (int run = 0; run < FUZZ_RANDOM_RUNS; run++) {
+            size_t size = nextRandom() % FUZZ_RANDOM_MAX;
+            for (size_t i = 0; i < size; i++) {
+                input[i] = (uint8_t)nextRandom();
+            }
+            LLVMFuzzerTestOneInput(input, size);
+        }
+    }
+    printf("fuzz: all inputs passed\n");
+    free(input);
+    free(seed);
+    return 0;
+}
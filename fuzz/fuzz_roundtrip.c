@@ -0,0 +1,126 @@
+// Differential target for the streaming engines: a cover generated from the input (BMP or PNG, with
+// bench.c's generator) and the rest of the input as the payload are hidden with three contexts, and
+// the stego files must be byte-identical. The reference context has an unbounded memory budget and
+// ROUNDTRIP_WORKERS threads, one has a tiny budget (so the cover spans many bands) and one a single
+// worker. Each stego file must then extract to the payload.
+//
+// Build from the repository root with libFuzzer:
+//   clang -O1 -g -fsanitize=fuzzer,address,undefined -I. -o fuzz_roundtrip fuzz/fuzz_roundtrip.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./fuzz_roundtrip
+// or with gcc and the stand-in driver (random inputs):
+//   gcc -O1 -g -fsanitize=address,undefined -I. -o fuzz_roundtrip fuzz/fuzz_roundtrip.c fuzz/fuzz_main.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./fuzz_roundtrip
+
+#include "steganography.h"
+#include "bench.h"
+#include <unistd.h>
+
+// Input bytes before the payload: bit depth and mode, width, height and the cover seed
+#define ROUNDTRIP_HEADER_SIZE 9
+#define ROUNDTRIP_MAX_SIDE 256
+// Threads of the reference and tiny-budget contexts, whatever the machine has
+#define ROUNDTRIP_WORKERS 4
+#define ROUNDTRIP_CONTEXTS 3
+
+static StegoContext contexts[ROUNDTRIP_CONTEXTS];
+static const char* const contextNames[ROUNDTRIP_CONTEXTS] = { "unbounded", "tiny --mem-limit", "one worker" };
+// Where mismatches are reported; the engines' own error messages are discarded
+static FILE* report = NULL;
+
+// Compare the contents of two files from the start
+static int sameContents(FILE* first, FILE* second) {
+    uint8_t a[4096], b[4096];
+    rewind(first);
+    rewind(second);
+    while (1) {
+        size_t countA = fread(a, 1, sizeof(a), first);
+        size_t countB = fread(b, 1, sizeof(b), second);
+        if (countA != countB || memcmp(a, b, countA) != 0) return 0;
+        if (countA == 0) return 1;
+    }
+}
+
+static void reportFailure(const char* what, int context, int bits_to_hide, int mode, int png, int width, int height,
+                          size_t length) {
+    fprintf(report, "fuzz_roundtrip: %s (%s context)\n", what, contextNames[context]);
+    fprintf(report, "  %s %dx%d, %d bits, mode %d, payload of %zu bytes\n", png ? "PNG" : "BMP", width, height,
+            bits_to_hide, mode, length);
+    abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (!report) {
+        for (int i = 0; i < ROUNDTRIP_CONTEXTS; i++) {
+            stegoContextInit(&contexts[i], 0);
+            // The thread count only takes effect before the first task
+            contexts[i].workers.limit = i == 2 ? 1 : ROUNDTRIP_WORKERS;
+        }
+        contexts[1].memoryLimit = 1; // Raised to the smallest band size
+        report = stderr;
+        stderr = fopen("/dev/null", "w");
+        if (!stderr) abort();
+    }
+    if (size < ROUNDTRIP_HEADER_SIZE) return 0;
+
+    // Mode 0 is the plain kernel, 1 --luma and 2 --constant-time
+    int bits_to_hide = 1 + (data[0] & 3);
+    int mode = (data[0] >> 2) % 3;
+    int png = (data[0] >> 4) & 1;
+    int pattern = (data[0] >> 5) % 3;
+    int width = 2 + (data[1] | (data[2] << 8)) % (ROUNDTRIP_MAX_SIDE - 1);
+    int height = 1 + (data[3] | (data[4] << 8)) % ROUNDTRIP_MAX_SIDE;
+    uint32_t seed = loadUint32(data + 5);
+    for (int i = 0; i < ROUNDTRIP_CONTEXTS; i++) {
+        contexts[i].luma = mode == 1;
+        contexts[i].constantTime = mode == 2;
+    }
+
+    FILE* cover = tmpfile();
+    FILE* payload = tmpfile();
+    FILE* stego[ROUNDTRIP_CONTEXTS];
+    FILE* extracted = tmpfile();
+    for (int i = 0; i < ROUNDTRIP_CONTEXTS; i++) stego[i] = tmpfile();
+    if (!cover || !payload || !extracted || !stego[0] || !stego[1] || !stego[2]) abort();
+
+    int result = png ? generatePngCover(&contexts[0], cover, width, height, pattern, seed)
+                     : generateCover(cover, width, height, pattern, seed);
+    if (result) abort();
+
+    // The payload is cut to what the cover holds with 3 slots per group (luma holds more)
+    long capacity = png ? ((long)width * height * 3 - 3) / (4 * 3) * 3 * bits_to_hide / 8
+                        : coverCapacity(cover, bits_to_hide);
+    long overhead = PAYLOAD_HEADER_SIZE + PAYLOAD_CHECKSUM_SIZE + (long)strlen(TERMINATOR_SEQUENCE);
+    size_t length = size - ROUNDTRIP_HEADER_SIZE;
+    if (capacity < overhead) {
+        length = 0;
+    } else if ((long)length > capacity - overhead) {
+        length = (size_t)(capacity - overhead);
+    }
+    if (fwrite(data + ROUNDTRIP_HEADER_SIZE, 1, length, payload) != length) abort();
+
+    for (int i = 0; i < ROUNDTRIP_CONTEXTS; i++) {
+        rewind(cover);
+        rewind(payload);
+        result = hideData(&contexts[i], payload, cover, stego[i], bits_to_hide);
+        // Only a cover too small for the frame may be refused
+        if (result && capacity >= overhead) {
+            reportFailure("hideData failed", i, bits_to_hide, mode, png, width, height, length);
+        }
+        if (result) break;
+        if (i > 0 && !sameContents(stego[0], stego[i])) {
+            reportFailure("stego file differs from the reference", i, bits_to_hide, mode, png, width, height, length);
+        }
+
+        rewind(stego[i]);
+        if (fflush(extracted) != 0 || ftruncate(fileno(extracted), 0) != 0) abort();
+        rewind(extracted);
+        if (extractData(&contexts[i], stego[i], extracted, bits_to_hide) != SUCCESSFUL ||
+            !sameContents(payload, extracted)) {
+            reportFailure("extracted data differs from the payload", i, bits_to_hide, mode, png, width, height, length);
+        }
+    }
+
+    for (int i = 0; i < ROUNDTRIP_CONTEXTS; i++) fclose(stego[i]);
+    fclose(extracted);
+    fclose(payload);
+    fclose(cover);
+    return 0;
+}
@@ -1,8 +1,52 @@
 #include "steganography.h"
 #include "utils.h"
+#include "archive.h"
+#include "shard.h"
+#include "update.h"
+#include "analysis.h"
+#include "scan.h"
+#include "bench.h"
+#include "tiles.h"
+#include "pngcodec.h"
+#include <signal.h>
 
 // Global variable to store bits used for hiding is declared in utils.h
 
+// Set by Ctrl-C; long operations poll it through their progress hook and stop cleanly
+static volatile sig_atomic_t interrupted = 0;
+
+// First Ctrl-C asks the running operation to stop; a second one ends the program at once
+static void handleInterrupt(int signalNumber) {
+    interrupted = 1;
+    signal(signalNumber, SIG_DFL);
+}
+
+// State of the --progress display
+typedef struct {
+    const char* label;
+    int show;         // --progress was given
+    int lastPercent;
+    int lineOpen;     // A progress line is on screen without its newline
+} ProgressDisplay;
+
+// Progress hook for the library: print the percentage when it changes and report Ctrl-C as a cancel
+static int reportProgress(void* progressData, uint64_t done, uint64_t total) {
+    ProgressDisplay* display = (ProgressDisplay*)progressData;
+    if (display->show && total > 0) {
+        int percent = (int)(done * 100 / total);
+        if (percent != display->lastPercent) {
+            fprintf(stderr, "\r%s: %3d%%", display->label, percent);
+            display->lastPercent = percent;
+            display->lineOpen = 1;
+        }
+        if (done >= total && display->lineOpen) {
+            fputc('\n', stderr);
+            display->lineOpen = 0;
+        }
+    }
+    return interrupted;
+}
+
 int main(int argc, char *argv[]) {
     // If no arguments are provided, display the usage menu
     if (argc == 1) {
@@ -23,8 +67,20 @@ int main(int argc, char *argv[]) {
     int optional = 0;
     int bits_to_hide = 2;
 
+    // Options that apply to every command are taken out before the per-command checks
+    GlobalOptions options = { DEFAULT_MEMORY_LIMIT, DEFAULT_PNG_LEVEL, 0, 0, 0 };
+    int result = checkGlobalOptions(&argc, argv, &options);
+    if (result) {
+        fprintf(stderr, "Closing program. [Error %d]\n", result);
+        return result;
+    }
+    if (argc == 1) {
+        displayMenu();
+        return 0;
+    }
+
     // Check command line parameters and validate them
-    int result = checkParams(argc, argv, &selection, &optional, &bits_to_hide);
+    result = checkParams(argc, argv, &selection, &optional, &bits_to_hide);
     if (result) {
         // If parameters are incorrect, print an error message and return the error code
         fprintf(stderr, "Closing program. [Error %d]\n", result);
@@ -34,8 +90,105 @@ int main(int argc, char *argv[]) {
     // Set the global variable for bits to hide
     global_bits_to_hide = bits_to_hide;
 
-    // Process based on selection (hide or extract)
-    if (!selection) { // If selection is hide
+    // Scratch memory for the embed/extract engines, with huge pages for large buffers where available
+    StegoContext context;
+    stegoContextInit(&context, 1);
+    context.memoryLimit = options.memoryLimit;
+    context.pngLevel = options.pngLevel;
+    context.constantTime = options.constantTime;
+    context.luma = options.luma;
+
+    // Commands that write images or scan them block by block report progress and can be cancelled
+    // with Ctrl-C; outputs only replace their targets once complete
+    ProgressDisplay display = { argv[1] + 1, options.progress, -1, 0 };
+    OutputFile output;
+    memset(&output, 0, sizeof(output));
+    if (selection == SELECT_HIDE || selection == SELECT_ARCHIVE || selection == SELECT_SHARD ||
+        selection == SELECT_EXTRACT || selection == SELECT_UNSHARD || selection == SELECT_MEMBER ||
+        selection == SELECT_UPDATE || selection == SELECT_ANALYZE) {
+        context.progress = reportProgress;
+        context.progressData = &display;
+        signal(SIGINT, handleInterrupt);
+    }
+
+    // Process based on selection (hide, extract or an archive command)
+    if (selection == SELECT_SHARD) { // If selection is shard
+        mf = argv[3]; // Message file
+        cf = argv[5]; // Comma separated cover files
+        of = optional ? argv[9] : DEFAULT_SHARD_OUTPUT_PREFIX; // Output file prefix
+        // Check access and open the message file for reading (covers and outputs are opened by the workers)
+        result = fileAccessCheck((char*)mf, &inputFile, READ_FILE);
+        if (result) return result;
+        // Split the message across the covers
+        result = hideShards(&context, inputFile, cf, of, bits_to_hide);
+        if (result) {
+            if (display.lineOpen) fputc('\n', stderr);
+            fprintf(stderr, "Error hiding data. [Error %d]\n", result);
+            fclose(inputFile);
+            return result;
+        }
+    } else if (selection == SELECT_UPDATE) { // If selection is update
+        mf = argv[3]; // New message file
+        sf = argv[5]; // Stego file, modified in place
+        // Check access and open the message file for reading
+        result = fileAccessCheck((char*)mf, &inputFile, READ_FILE);
+        if (result) return result;
+        // Patch only the pixel groups whose hidden bits change
+        result = updateData(&context, inputFile, sf, bits_to_hide);
+        if (result) {
+            if (display.lineOpen) fputc('\n', stderr);
+            fprintf(stderr, "Error updating data. [Error %d]\n", result);
+            fclose(inputFile);
+            return result;
+        } else {
+            printf("Data successfully updated in %s.\n", sf);
+        }
+    } else if (selection == SELECT_SCAN) { // If selection is scan
+        sf = argv[3]; // Directory to scan
+        // Candidates go to the console unless a report file is given
+        FILE* report = stdout;
+        if (optional) {
+            of = argv[5]; // Report file
+            result = fileAccessCheck((char*)of, &outputFile, WRITE_FILE);
+            if (result) return result;
+            report = outputFile;
+        }
+        result = scanDirectory(sf, report);
+        if (result) {
+            fprintf(stderr, "Error scanning directory. [Error %d]\n", result);
+            return result;
+        }
+    } else if (selection == SELECT_BENCH) { // If selection is bench
+        sf = argv[3]; // Work directory for the generated files
+        of = optional ? argv[5] : NULL; // Baseline file
+        result = runBenchmark(&context, argv[0], sf, of); // Times this program as a separate process
+        if (result) {
+            fprintf(stderr, "Benchmark failed. [Error %d]\n", result);
+            return result;
+        }
+    } else if (selection == SELECT_ANALYZE) { // If selection is analyze
+        sf = argv[3]; // Stego file
+        // Check access and open the stego file (and the optional cover) for reading
+        result = fileAccessCheck((char*)sf, &stegoFile, READ_FILE);
+        if (result) return result;
+        if (optional) {
+            cf = argv[5]; // Cover file
+            result = fileAccessCheck((char*)cf, &coverFile, READ_FILE);
+            if (result) return result;
+        }
+        // Gate on the steganalysis verdict
+        int detected = 0;
+        result = analyzeImage(&context, stegoFile, coverFile, &detected);
+        if (result) {
+            if (display.lineOpen) fputc('\n', stderr);
+            fprintf(stderr, "Error analyzing image. [Error %d]\n", result);
+            return result;
+        }
+        if (detected) {
+            fprintf(stderr, "Stego image %s is statistically detectable. [Error %d]\n", sf, DETECTABLE_ERROR);
+            return DETECTABLE_ERROR;
+        }
+    } else if (selection == SELECT_HIDE || selection == SELECT_ARCHIVE) { // If selection is hide or archive
         mf = argv[3]; // Message file
         cf = argv[5]; // Cover file
         if (!optional) {
@@ -47,25 +200,39 @@ int main(int argc, char *argv[]) {
             }
             of = argv[9]; // Optional output file
         }
-        // Check access and open input files for reading
-        result = fileAccessCheck((char*)mf, &inputFile, READ_FILE);
-        if (result) return result;
+        // Check access and open input files for reading (archive members are opened by hideArchive)
+        if (selection == SELECT_HIDE) {
+            result = fileAccessCheck((char*)mf, &inputFile, READ_FILE);
+            if (result) return result;
+        }
         result = fileAccessCheck((char*)cf, &coverFile, READ_FILE);
         if (result) return result;
-        // Check access and open output file for writing
-        result = fileAccessCheck((char*)of, &outputFile, WRITE_FILE);
+        // The output has the cover's format, so a PNG cover gets a .png default name
+        if (!optional && isPngFile(coverFile)) {
+            of = DEFAULT_HIDE_PNG_OUTPUT_FILE;
+        }
+        // Open a temporary output file next to the output, renamed over it once complete
+        result = outputFileOpen(&output, of);
         if (result) return result;
-        // Hide data in the BMP file
-        result = hideData(inputFile, coverFile, outputFile, bits_to_hide);
+        // Hide data (or the archive of all message files) in the BMP file
+        if (selection == SELECT_HIDE) {
+            result = hideData(&context, inputFile, coverFile, output.file, bits_to_hide);
+        } else {
+            result = hideArchive(&context, mf, coverFile, output.file, bits_to_hide);
+        }
+        if (!result) result = outputFileCommit(&output);
         if (result) {
             // If there is an error in hiding data, print an error message and return the error code
+            outputFileDiscard(&output);
+            if (display.lineOpen) fputc('\n', stderr);
             fprintf(stderr, "Error hiding data. [Error %d]\n", result);
+            if (result == CANCELLED_ERROR) fprintf(stderr, "Cancelled; nothing was written to %s.\n", of);
             return result;
         } else {
             // If data is successfully hidden, print a success message
             printf("Data successfully hidden in %s.\n", of);
         }
-    } else { // If selection is extract
+    } else if (selection == SELECT_EXTRACT || selection == SELECT_UNSHARD) { // If selection is extract or unshard
         sf = argv[3]; // Stego file
         if (!optional) {
             of = DEFAULT_EXTRACT_OUTPUT_FILE; // Default output file if optional output file is not provided
@@ -76,28 +243,68 @@ int main(int argc, char *argv[]) {
             }
             of = argv[7]; // Optional output file
         }
-        // Check access and open stego file for reading
-        result = fileAccessCheck((char*)sf, &stegoFile, READ_FILE);
+        // Check access and open stego file for reading (shards are opened by the workers)
+        if (selection == SELECT_EXTRACT) {
+            result = fileAccessCheck((char*)sf, &stegoFile, READ_FILE);
+            if (result) return result;
+        }
+        // Open a temporary output file next to the output, renamed over it once complete
+        result = outputFileOpen(&output, of);
         if (result) return result;
-        // Open output file for writing
-        outputFile = fopen(of, "wb");
-        if (!outputFile) {
-            // If there is an error in opening the output file, print an error message and return the error code
-            fprintf(stderr, "Error: Unable to create or write to the file: %s\n", of);
-            return FILE_ACCESS_ERROR;
-        }
-        // Extract data from the BMP file
-        result = extractData(stegoFile, outputFile, bits_to_hide);
+        // Extract data from the BMP file (or reassemble it from all shards)
+        if (selection == SELECT_EXTRACT) {
+            result = extractData(&context, stegoFile, output.file, bits_to_hide);
+        } else {
+            result = extractShards(&context, sf, output.file, bits_to_hide);
+        }
+        if (!result) result = outputFileCommit(&output);
         if (result) {
-            // If there is an error in extracting data, print an error message, close and remove the output file, and return the error code
+            // If there is an error in extracting data, print an error message, remove the partial output, and return the error code
+            outputFileDiscard(&output);
+            if (display.lineOpen) fputc('\n', stderr);
             fprintf(stderr, "Error extracting data. [Error %d]\n", result);
-            fclose(outputFile);
-            remove(of);  // Remove the output file
+            if (result == CANCELLED_ERROR) fprintf(stderr, "Cancelled; nothing was written to %s.\n", of);
             return result;
         } else {
             // If data is successfully extracted, print a success message
             printf("Data successfully extracted to %s.\n", of);
         }
+    } else if (selection == SELECT_LIST) { // If selection is list
+        sf = argv[3]; // Stego file
+        // Check access and open stego file for reading
+        result = fileAccessCheck((char*)sf, &stegoFile, READ_FILE);
+        if (result) return result;
+        // Print the archive directory
+        result = listArchive(&context, stegoFile, bits_to_hide);
+        if (result) {
+            fprintf(stderr, "Error listing archive. [Error %d]\n", result);
+            fclose(stegoFile);
+            return result;
+        }
+    } else { // If selection is member
+        sf = argv[3]; // Stego file
+        const char* name = argv[7]; // Archive member name
+        of = optional ? argv[9] : name; // Default output file is the member name
+        // Check access and open stego file for reading
+        result = fileAccessCheck((char*)sf, &stegoFile, READ_FILE);
+        if (result) return result;
+        // Open a temporary output file next to the output, renamed over it once complete
+        result = outputFileOpen(&output, of);
+        if (result) return result;
+        // Extract the member from the archive
+        result = extractArchiveMember(&context, stegoFile, bits_to_hide, name, output.file);
+        if (!result) result = outputFileCommit(&output);
+        if (result) {
+            // If there is an error in extracting the member, remove the partial output
+            if (display.lineOpen) fputc('\n', stderr);
+            fprintf(stderr, "Error extracting archive member. [Error %d]\n", result);
+            if (result == CANCELLED_ERROR) fprintf(stderr, "Cancelled; nothing was written to %s.\n", of);
+            fclose(stegoFile);
+            outputFileDiscard(&output);
+            return result;
+        } else {
+            printf("Member %s successfully extracted to %s.\n", name, of);
+        }
     }
 
     // Close all file pointers
@@ -105,6 +312,7 @@ int main(int argc, char *argv[]) {
     if (coverFile) fclose(coverFile);
     if (stegoFile) fclose(stegoFile);
     if (outputFile) fclose(outputFile);
+    stegoContextRelease(&context);
 
     return 0; // Return success code
 }
@@ -0,0 +1,625 @@
+#include "pngcodec.h"
+#include "utils.h"
+
+static const uint8_t pngSignature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// Store a 32-bit value in big-endian (network) order, as PNG chunks do
+static void storeUint32BE(uint8_t* out, uint32_t value) {
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+// Load a 32-bit big-endian value
+static uint32_t loadUint32BE(const uint8_t* in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+// Paeth predictor: whichever of left, above and upper-left is closest to left + above - upper-left
+static int paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// zlib allocator drawing from a context arena, so codec state is reused like any other scratch memory
+static voidpf arenaZalloc(voidpf opaque, uInt items, uInt size) {
+    return arenaAlloc((StegoArena*)opaque, (size_t)items * size);
+}
+
+// Arena memory is released all at once by arenaReset
+static void arenaZfree(voidpf opaque, voidpf address) {
+    (void)opaque;
+    (void)address;
+}
+
+// Check the PNG signature without disturbing the current read position
+int isPngFile(FILE* file) {
+    uint8_t signature[PNG_SIGNATURE_SIZE];
+    long position = ftell(file);
+    rewind(file);
+    size_t readCount = fread(signature, 1, PNG_SIGNATURE_SIZE, file);
+    fseek(file, position, SEEK_SET);
+    return readCount == PNG_SIGNATURE_SIZE && memcmp(signature, pngSignature, PNG_SIGNATURE_SIZE) == 0;
+}
+
+// Unsafe-to-copy ancillary chunks that still hold for the output: the color space, the physical
+// size, text and the modification time. The others (tRNS, sBIT, hIST, unknown ones) depend on the
+// pixel values, which the hidden bits change, and are dropped.
+static const char* const copiedUnsafeChunks[] = { "gAMA", "cHRM", "sRGB", "iCCP", "tIME" };
+
+// Ancillary chunks (lowercase first letter) are copied to the output when their safe-to-copy bit
+// (lowercase last letter) is set or they are listed above. eXIf is safe to copy but is dropped,
+// since it may carry a thumbnail of the cover.
+static int isCopiedChunk(const uint8_t* type) {
+    if ((type[0] & 0x20) == 0 || memcmp(type, "eXIf", 4) == 0) {
+        return 0;
+    }
+    if ((type[3] & 0x20) != 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(copiedUnsafeChunks) / sizeof(copiedUnsafeChunks[0]); i++) {
+        if (memcmp(type, copiedUnsafeChunks[i], 4) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Read the length and type of the next chunk
+static int readChunkHeader(FILE* file, uint32_t* length, uint8_t* type) {
+    uint8_t header[8];
+    if (fread(header, 1, 8, file) != 8) {
+        return 0;
+    }
+    *length = loadUint32BE(header);
+    memcpy(type, header + 4, 4);
+    return *length <= 0x7FFFFFFF; // Chunk lengths are limited to 2^31 - 1
+}
+
+// Read the data and CRC of a chunk whose header was just read and append the whole chunk, as
+// stored, to a list in the arena; 0 when the chunk runs past the end of the file
+static int keepChunk(PngReader* reader, uint32_t length, const uint8_t* type, PngChunk** list) {
+    long position = ftell(reader->file);
+    if (position < 0 || (uint64_t)length + 4 > (uint64_t)(reader->fileSize - position)) {
+        return 0;
+    }
+    PngChunk* chunk = (PngChunk*)arenaAlloc(reader->arena, sizeof(PngChunk));
+    uint8_t* bytes = (uint8_t*)arenaAlloc(reader->arena, (size_t)length + 12);
+    if (!chunk || !bytes) {
+        return 0;
+    }
+    storeUint32BE(bytes, length);
+    memcpy(bytes + 4, type, 4);
+    if (fread(bytes + 8, 1, (size_t)length + 4, reader->file) != (size_t)length + 4) {
+        return 0;
+    }
+    chunk->next = NULL;
+    chunk->bytes = bytes;
+    chunk->length = (size_t)length + 12;
+    while (*list) {
+        list = &(*list)->next;
+    }
+    *list = chunk;
+    return 1;
+}
+
+// Parse the header and move to the first IDAT chunk; only 8-bit RGB without interlacing is accepted,
+// which keeps the decoded rows byte-compatible with the 4-pixel group layout
+int pngReaderOpen(PngReader* reader, StegoArena* arena, FILE* file) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->arena = arena;
+
+    uint8_t signature[PNG_SIGNATURE_SIZE];
+    rewind(file);
+    if (fread(signature, 1, PNG_SIGNATURE_SIZE, file) != PNG_SIGNATURE_SIZE ||
+        memcmp(signature, pngSignature, PNG_SIGNATURE_SIZE) != 0) {
+        fprintf(stderr, "Error: File is not a PNG image.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+
+    // The header chunk always comes first
+    uint32_t length;
+    uint8_t type[4];
+    uint8_t header[13 + 4]; // Header data and its CRC
+    if (!readChunkHeader(file, &length, type) || memcmp(type, "IHDR", 4) != 0 || length != 13 ||
+        fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        fprintf(stderr, "Error: PNG header is missing or damaged.\n");
+        return GENERAL_ERROR;
+    }
+    reader->width = loadUint32BE(header);
+    reader->height = loadUint32BE(header + 4);
+    if (reader->width == 0 || reader->height == 0 || reader->width > 0x7FFFFFFF || reader->height > 0x7FFFFFFF) {
+        fprintf(stderr, "Error: PNG image has invalid dimensions.\n");
+        return GENERAL_ERROR;
+    }
+    if (header[8] != 8 || header[9] != 2 || header[10] != 0 || header[11] != 0 || header[12] != 0) {
+        fprintf(stderr, "Error: Only 8-bit RGB, non-interlaced PNG images are supported.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    reader->rowBytes = (size_t)reader->width * 3;
+
+    // A header promising more filtered rows than the rest of the file can inflate to is damaged,
+    // and must not size the row buffers
+    long position = ftell(file);
+    fseek(file, 0, SEEK_END);
+    reader->fileSize = ftell(file);
+    fseek(file, position, SEEK_SET);
+    if ((uint64_t)(reader->rowBytes + 1) * reader->height > (uint64_t)(reader->fileSize - position) * PNG_MAX_INFLATE_RATIO) {
+        fprintf(stderr, "Error: PNG image is larger than its data allows.\n");
+        return GENERAL_ERROR;
+    }
+
+    // Keep the copied ancillary chunks up to the image data for the writer, and skip any others
+    while (1) {
+        if (!readChunkHeader(file, &length, type)) {
+            fprintf(stderr, "Error: PNG image data is missing.\n");
+            return GENERAL_ERROR;
+        }
+        if (memcmp(type, "IDAT", 4) == 0) {
+            reader->chunkRemaining = length;
+            break;
+        }
+        if (isCopiedChunk(type)) {
+            if (!keepChunk(reader, length, type, &reader->leading)) {
+                fprintf(stderr, "Error: PNG chunk is damaged.\n");
+                return GENERAL_ERROR;
+            }
+        } else if (memcmp(type, "IEND", 4) == 0 || fseek(file, (long)length + 4, SEEK_CUR) != 0) {
+            fprintf(stderr, "Error: PNG image data is missing.\n");
+            return GENERAL_ERROR;
+        }
+    }
+
+    // Two rows with their filter type byte; the previous row starts out as zeros
+    reader->input = (uint8_t*)arenaAlloc(arena, PNG_READ_BUFFER);
+    reader->rows[0] = (uint8_t*)arenaAlloc(arena, reader->rowBytes + 1);
+    reader->rows[1] = (uint8_t*)arenaAlloc(arena, reader->rowBytes + 1);
+    if (!reader->input || !reader->rows[0] || !reader->rows[1]) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    memset(reader->rows[1], 0, reader->rowBytes + 1);
+    reader->current = 1;
+    reader->rowOffset = reader->rowBytes; // Nothing decoded yet
+
+    // The decoder allocates its window on the first inflate call, which also happens on this thread
+    reader->stream.zalloc = arenaZalloc;
+    reader->stream.zfree = arenaZfree;
+    reader->stream.opaque = arena;
+    if (inflateInit(&reader->stream) != Z_OK) {
+        fprintf(stderr, "Error: Unable to start the PNG decoder.\n");
+        return GENERAL_ERROR;
+    }
+    reader->streamReady = 1;
+    return SUCCESSFUL;
+}
+
+// Hand the decoder the next compressed bytes, following the image data across IDAT chunks
+static int fillInput(PngReader* reader) {
+    while (reader->chunkRemaining == 0) {
+        uint8_t crc[4];
+        uint32_t length;
+        uint8_t type[4];
+        if (reader->idatDone) return 0;
+        // The zlib stream carries its own checksum, so chunk CRCs are skipped
+        if (fread(crc, 1, 4, reader->file) != 4 || !readChunkHeader(reader->file, &length, type)) {
+            reader->idatDone = 1;
+            return 0;
+        }
+        if (memcmp(type, "IDAT", 4) != 0) {
+            // Left for pngReaderFinish
+            reader->idatDone = 1;
+            reader->nextRead = 1;
+            reader->nextLength = length;
+            memcpy(reader->nextType, type, 4);
+            return 0;
+        }
+        reader->chunkRemaining = length;
+    }
+    size_t wanted = reader->chunkRemaining < PNG_READ_BUFFER ? reader->chunkRemaining : PNG_READ_BUFFER;
+    size_t readCount = fread(reader->input, 1, wanted, reader->file);
+    if (readCount == 0) {
+        return 0;
+    }
+    reader->chunkRemaining -= readCount;
+    reader->stream.next_in = reader->input;
+    reader->stream.avail_in = readCount;
+    return 1;
+}
+
+// Inflate the next row and undo its filter against the previous row
+static int decodeRow(PngReader* reader) {
+    uint8_t* previous = reader->rows[reader->current] + 1;
+    reader->current ^= 1;
+    uint8_t* row = reader->rows[reader->current];
+    reader->stream.next_out = row;
+    reader->stream.avail_out = reader->rowBytes + 1;
+    while (reader->stream.avail_out > 0) {
+        if (reader->stream.avail_in == 0 && !fillInput(reader)) {
+            fprintf(stderr, "Error: PNG image data ends early.\n");
+            return 0;
+        }
+        int status = inflate(&reader->stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END && reader->stream.avail_out > 0) {
+            fprintf(stderr, "Error: PNG image data ends early.\n");
+            return 0;
+        }
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            fprintf(stderr, "Error: PNG image data is damaged.\n");
+            return 0;
+        }
+    }
+
+    // Reconstruct each byte from its left (3 bytes back), above and upper-left neighbours
+    uint8_t* x = row + 1;
+    size_t n = reader->rowBytes;
+    switch (row[0]) {
+        case 0: // None
+            break;
+        case 1: // Sub
+            for (size_t i = 3; i < n; i++) x[i] += x[i - 3];
+            break;
+        case 2: // Up
+            for (size_t i = 0; i < n; i++) x[i] += previous[i];
+            break;
+        case 3: // Average
+            for (size_t i = 0; i < 3; i++) x[i] += previous[i] >> 1;
+            for (size_t i = 3; i < n; i++) x[i] += (x[i - 3] + previous[i]) >> 1;
+            break;
+        case 4: // Paeth
+            for (size_t i = 0; i < 3; i++) x[i] += previous[i];
+            for (size_t i = 3; i < n; i++) x[i] += paethPredictor(x[i - 3], previous[i], previous[i - 3]);
+            break;
+        default:
+            fprintf(stderr, "Error: PNG row has an unknown filter type %d.\n", row[0]);
+            return 0;
+    }
+    return 1;
+}
+
+// Read up to length bytes of pixel data, decoding rows as needed; returns fewer at the end of the
+// image or on an error (reader->error is then set)
+size_t pngReaderRead(PngReader* reader, uint8_t* out, size_t length) {
+    size_t copied = 0;
+    while (copied < length && !reader->error) {
+        if (reader->rowOffset == reader->rowBytes) {
+            if (reader->rowsDecoded == reader->height) break;
+            if (!decodeRow(reader)) {
+                reader->error = GENERAL_ERROR;
+                break;
+            }
+            reader->rowsDecoded++;
+            reader->rowOffset = 0;
+        }
+        size_t available = reader->rowBytes - reader->rowOffset;
+        size_t take = length - copied < available ? length - copied : available;
+        memcpy(out + copied, reader->rows[reader->current] + 1 + reader->rowOffset, take);
+        reader->rowOffset += take;
+        copied += take;
+    }
+    return copied;
+}
+
+// Read the chunks after the image data, keeping the copied ancillary ones in reader->trailing. A
+// damaged or truncated tail only ends the list early, since the pixels have already been decoded.
+void pngReaderFinish(PngReader* reader) {
+    uint32_t length;
+    uint8_t type[4];
+    if (reader->nextRead) {
+        length = reader->nextLength;
+        memcpy(type, reader->nextType, 4);
+        reader->nextRead = 0;
+    } else {
+        if (reader->idatDone) return; // Nothing readable after the image data
+        // The decoder may stop before the end of the image data: skip what is left of it
+        uint8_t crc[4];
+        if (fseek(reader->file, reader->chunkRemaining, SEEK_CUR) != 0) return;
+        while (1) {
+            if (fread(crc, 1, 4, reader->file) != 4 || !readChunkHeader(reader->file, &length, type)) return;
+            if (memcmp(type, "IDAT", 4) != 0) break;
+            if (fseek(reader->file, length, SEEK_CUR) != 0) return;
+        }
+    }
+    reader->idatDone = 1;
+
+    while (memcmp(type, "IEND", 4) != 0) {
+        if (isCopiedChunk(type)) {
+            if (!keepChunk(reader, length, type, &reader->trailing)) return;
+        } else if (fseek(reader->file, (long)length + 4, SEEK_CUR) != 0) {
+            return;
+        }
+        if (!readChunkHeader(reader->file, &length, type)) return;
+    }
+}
+
+// Release the decoder (row buffers belong to the arena)
+void pngReaderClose(PngReader* reader) {
+    if (reader->streamReady) {
+        inflateEnd(&reader->stream);
+        reader->streamReady = 0;
+    }
+}
+
+// Write one chunk with its length and CRC
+static void writeChunk(FILE* file, const char* type, const uint8_t* data, size_t length) {
+    uint8_t header[8];
+    storeUint32BE(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = crc32(0, header + 4, 4);
+    if (length) crc = crc32(crc, data, length); // A null buffer would restart the CRC
+    uint8_t trailer[4];
+    storeUint32BE(trailer, crc);
+    fwrite(header, 1, 8, file);
+    if (length) fwrite(data, 1, length, file);
+    fwrite(trailer, 1, 4, file);
+}
+
+// Pool task: compress one chunk of filtered rows as a continuation of the previous chunk's stream
+static void deflateJob(void* argument) {
+    PngDeflateJob* job = (PngDeflateJob*)argument;
+    z_stream* stream = &job->stream;
+    // Start a fresh stream on the job's existing state, which allocates nothing
+    if (deflateReset(stream) != Z_OK) {
+        job->result = GENERAL_ERROR;
+        return;
+    }
+    // Let matches reach back into the previous chunk, as a single-threaded encoder would
+    if (job->dictionaryLength) {
+        deflateSetDictionary(stream, job->dictionary, job->dictionaryLength);
+    }
+    stream->next_in = job->input;
+    stream->avail_in = job->inputLength;
+    stream->next_out = job->output + 2;
+    stream->avail_out = job->outputCapacity;
+    // A sync flush ends on a byte boundary without closing the stream, so chunks concatenate
+    int status = deflate(stream, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (job->last ? status != Z_STREAM_END : (status != Z_OK || stream->avail_out == 0)) {
+        job->result = GENERAL_ERROR;
+    }
+    job->outputLength = job->outputCapacity - stream->avail_out;
+    job->adler = adler32(adler32(0, NULL, 0), job->input, job->inputLength);
+}
+
+// Write the PNG signature and header and set up the row and job buffers. Each job's deflate state
+// is set up here, on the calling thread, because the arena is not thread-safe.
+int pngWriterOpen(PngWriter* writer, StegoArena* arena, WorkerPool* workers, FILE* file, uint32_t width, uint32_t height,
+                  int level) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+    writer->workers = workers;
+    writer->height = height;
+    writer->rowBytes = (size_t)width * 3;
+    writer->adler = adler32(0, NULL, 0);
+
+    // Whole filtered rows per job, one row when a row alone exceeds the chunk size
+    size_t filteredRow = writer->rowBytes + 1;
+    size_t rowsPerChunk = PNG_DEFLATE_CHUNK / filteredRow;
+    writer->chunkCapacity = (rowsPerChunk ? rowsPerChunk : 1) * filteredRow;
+
+    int threads = workerPoolSize(workers);
+    writer->jobCount = threads > PNG_MAX_JOBS ? PNG_MAX_JOBS : threads;
+
+    writer->rows[0] = (uint8_t*)arenaAlloc(arena, writer->rowBytes);
+    writer->rows[1] = (uint8_t*)arenaAlloc(arena, writer->rowBytes);
+    if (!writer->rows[0] || !writer->rows[1]) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    memset(writer->rows[1], 0, writer->rowBytes); // The row above the first one is all zeros
+    for (int j = 0; j < writer->jobCount; j++) {
+        PngDeflateJob* job = &writer->jobs[j];
+        job->level = level;
+        job->outputCapacity = compressBound(writer->chunkCapacity) + 64; // Room for the flush marker
+        job->input = (uint8_t*)arenaAlloc(arena, writer->chunkCapacity);
+        job->dictionary = (uint8_t*)arenaAlloc(arena, PNG_WINDOW_SIZE);
+        job->output = (uint8_t*)arenaAlloc(arena, job->outputCapacity + 2 + 4);
+        if (!job->input || !job->dictionary || !job->output) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            return GENERAL_ERROR;
+        }
+        // Raw deflate: the writer emits the zlib header and the combined Adler-32 itself
+        job->stream.zalloc = arenaZalloc;
+        job->stream.zfree = arenaZfree;
+        job->stream.opaque = arena;
+        if (deflateInit2(&job->stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Error: Unable to start the PNG encoder.\n");
+            return GENERAL_ERROR;
+        }
+        job->streamReady = 1;
+    }
+
+    uint8_t header[13];
+    storeUint32BE(header, width);
+    storeUint32BE(header + 4, height);
+    header[8] = 8;   // Bit depth
+    header[9] = 2;   // Color type: RGB
+    header[10] = 0;  // Deflate compression
+    header[11] = 0;  // Adaptive filtering
+    header[12] = 0;  // No interlacing
+    fwrite(pngSignature, 1, PNG_SIGNATURE_SIZE, file);
+    writeChunk(file, "IHDR", header, sizeof(header));
+    return SUCCESSFUL;
+}
+
+// Filter one row into out (type byte first). The filter is picked with the usual minimum sum of
+// absolute differences heuristic, scoring all five filters in a single pass over the row.
+static void filterRow(const uint8_t* raw, const uint8_t* previous, size_t n, int level, uint8_t* out) {
+    int filter = 0;
+    if (level > 0) { // Stored output gains nothing from filtering
+        unsigned long sums[5] = { 0 };
+        for (size_t i = 0; i < n; i++) {
+            int a = i >= 3 ? raw[i - 3] : 0;
+            int b = previous[i];
+            int c = i >= 3 ? previous[i - 3] : 0;
+            int x = raw[i];
+            // Residuals are scored as signed bytes: small positive or negative values compress best
+            uint8_t r0 = (uint8_t)x;
+            uint8_t r1 = (uint8_t)(x - a);
+            uint8_t r2 = (uint8_t)(x - b);
+            uint8_t r3 = (uint8_t)(x - ((a + b) >> 1));
+            uint8_t r4 = (uint8_t)(x - paethPredictor(a, b, c));
+            sums[0] += r0 < 128 ? r0 : 256 - r0;
+            sums[1] += r1 < 128 ? r1 : 256 - r1;
+            sums[2] += r2 < 128 ? r2 : 256 - r2;
+            sums[3] += r3 < 128 ? r3 : 256 - r3;
+            sums[4] += r4 < 128 ? r4 : 256 - r4;
+        }
+        for (int f = 1; f < 5; f++) {
+            if (sums[f] < sums[filter]) filter = f;
+        }
+    }
+
+    out[0] = (uint8_t)filter;
+    uint8_t* x = out + 1;
+    switch (filter) {
+        case 0:
+            memcpy(x, raw, n);
+            break;
+        case 1:
+            for (size_t i = 0; i < n; i++) x[i] = raw[i] - (i >= 3 ? raw[i - 3] : 0);
+            break;
+        case 2:
+            for (size_t i = 0; i < n; i++) x[i] = raw[i] - previous[i];
+            break;
+        case 3:
+            for (size_t i = 0; i < n; i++) x[i] = raw[i] - (((i >= 3 ? raw[i - 3] : 0) + previous[i]) >> 1);
+            break;
+        default:
+            for (size_t i = 0; i < n; i++) {
+                x[i] = raw[i] - paethPredictor(i >= 3 ? raw[i - 3] : 0, previous[i], i >= 3 ? previous[i - 3] : 0);
+            }
+            break;
+    }
+}
+
+// Wait for a job and write its output as an IDAT chunk, adding the zlib header to the first
+// one and the combined Adler-32 to the last one
+static void finishJob(PngWriter* writer, PngDeflateJob* job) {
+    workerPoolWait(writer->workers, &job->task);
+    job->active = 0;
+    if (job->result) {
+        writer->error = job->result;
+        return;
+    }
+    if (writer->error) return;
+
+    uint8_t* start = job->output + 2;
+    size_t length = job->outputLength;
+    if (!writer->headerWritten) {
+        // Deflate with a 32K window; the level hint follows zlib's own header
+        int levelHint = job->level < 2 ? 0 : (job->level < 6 ? 1 : (job->level == 6 ? 2 : 3));
+        int flags = levelHint << 6;
+        flags += 31 - ((0x78 << 8) + flags) % 31;
+        start -= 2;
+        start[0] = 0x78;
+        start[1] = (uint8_t)flags;
+        length += 2;
+        writer->headerWritten = 1;
+    }
+    writer->adler = adler32_combine(writer->adler, job->adler, (z_off_t)job->inputLength);
+    if (job->last) {
+        storeUint32BE(job->output + 2 + job->outputLength, writer->adler);
+        length += 4;
+    }
+    writeChunk(writer->file, "IDAT", start, length);
+}
+
+// Start compressing the job being filled and, unless it is the last one, move on to the next slot
+static void launchJob(PngWriter* writer) {
+    PngDeflateJob* job = &writer->jobs[writer->slot];
+    job->last = writer->rowsWritten == writer->height;
+    job->active = 1;
+    job->result = SUCCESSFUL;
+    workerPoolSubmit(writer->workers, &job->task, deflateJob, job);
+    if (job->last) return;
+
+    // Reclaim the next slot (its job is the oldest in flight) and seed its dictionary from the
+    // chunk just launched, which is only read from here on
+    int next = (writer->slot + 1) % writer->jobCount;
+    PngDeflateJob* nextJob = &writer->jobs[next];
+    if (nextJob->active) {
+        finishJob(writer, nextJob);
+    }
+    size_t window = job->inputLength < PNG_WINDOW_SIZE ? job->inputLength : PNG_WINDOW_SIZE;
+    memcpy(nextJob->dictionary, job->input + job->inputLength - window, window);
+    nextJob->dictionaryLength = window;
+    nextJob->inputLength = 0;
+    writer->slot = next;
+}
+
+// Filter a completed row into the current job, launching jobs as they fill up
+static void appendRow(PngWriter* writer) {
+    PngDeflateJob* job = &writer->jobs[writer->slot];
+    if (job->inputLength + writer->rowBytes + 1 > writer->chunkCapacity) {
+        launchJob(writer);
+        job = &writer->jobs[writer->slot];
+    }
+    filterRow(writer->rows[writer->current], writer->rows[writer->current ^ 1], writer->rowBytes, job->level,
+              job->input + job->inputLength);
+    job->inputLength += writer->rowBytes + 1;
+    writer->current ^= 1;
+    writer->rowsWritten++;
+    if (writer->rowsWritten == writer->height) {
+        launchJob(writer);
+    }
+}
+
+// Append pixel data to the image; rows are encoded as soon as they are complete
+int pngWriterWrite(PngWriter* writer, const uint8_t* data, size_t length) {
+    while (length > 0 && !writer->error) {
+        if (writer->rowsWritten == writer->height) {
+            fprintf(stderr, "Error: More pixel data than the PNG image holds.\n");
+            writer->error = GENERAL_ERROR;
+            break;
+        }
+        size_t space = writer->rowBytes - writer->rowFill;
+        size_t take = length < space ? length : space;
+        memcpy(writer->rows[writer->current] + writer->rowFill, data, take);
+        writer->rowFill += take;
+        data += take;
+        length -= take;
+        if (writer->rowFill == writer->rowBytes) {
+            appendRow(writer);
+            writer->rowFill = 0;
+        }
+    }
+    return writer->error;
+}
+
+// Copy kept chunks to the output as they were stored. Called before the first row, they land
+// between IHDR and the image data.
+void pngWriterCopyChunks(PngWriter* writer, const PngChunk* chunks) {
+    for (; chunks; chunks = chunks->next) {
+        fwrite(chunks->bytes, 1, chunks->length, writer->file);
+    }
+}
+
+// Wait for the jobs still in flight, oldest first, and end the image, copying the trailing chunks
+// just before IEND
+int pngWriterClose(PngWriter* writer, const PngChunk* trailing) {
+    for (int i = 1; i <= writer->jobCount; i++) {
+        PngDeflateJob* job = &writer->jobs[(writer->slot + i) % writer->jobCount];
+        if (job->active) {
+            finishJob(writer, job);
+        }
+    }
+    if (!writer->error && writer->rowsWritten != writer->height) {
+        fprintf(stderr, "Error: PNG image data is incomplete.\n");
+        writer->error = GENERAL_ERROR;
+    }
+    if (!writer->error) {
+        pngWriterCopyChunks(writer, trailing);
+        writeChunk(writer->file, "IEND", NULL, 0);
+    }
+    for (int j = 0; j < writer->jobCount; j++) {
+        if (writer->jobs[j].streamReady) {
+            deflateEnd(&writer->jobs[j].stream);
+            writer->jobs[j].streamReady = 0;
+        }
+    }
+    return writer->error;
+}
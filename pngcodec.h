@@ -0,0 +1,116 @@
+#ifndef PNGCODEC_H
+#define PNGCODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "arena.h"
+#include "workers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PNG_SIGNATURE_SIZE 8
+// zlib level used when --png-level is not given
+#define DEFAULT_PNG_LEVEL 6
+// Filtered bytes handed to each parallel deflate job (fewer when a single row is larger)
+#define PNG_DEFLATE_CHUNK (256 * 1024)
+// Deflate jobs in flight at once, at most one per processor
+#define PNG_MAX_JOBS 8
+// Back-reference window carried from one job into the next as a preset dictionary
+#define PNG_WINDOW_SIZE 32768
+// Compressed bytes read from the IDAT chunks at a time
+#define PNG_READ_BUFFER (64 * 1024)
+// Deflate never expands its input by more than this factor
+#define PNG_MAX_INFLATE_RATIO 1032
+
+// A copied ancillary chunk kept as stored (length, type, data and CRC) so it can be copied to the output
+typedef struct PngChunk {
+    struct PngChunk* next;
+    uint8_t* bytes;
+    size_t length;
+} PngChunk;
+
+// Decodes the pixel data of an 8-bit RGB, non-interlaced PNG as one flat stream of unfiltered
+// rows, keeping only the current and previous row in memory
+typedef struct {
+    FILE* file;
+    StegoArena* arena;        // Holds the rows and the kept chunks
+    long fileSize;
+    uint32_t width;
+    uint32_t height;
+    size_t rowBytes;          // Bytes per row without the filter type byte
+    z_stream stream;
+    int streamReady;          // inflateInit succeeded and inflateEnd is due
+    uint8_t* input;           // Compressed bytes from the IDAT chunks
+    uint32_t chunkRemaining;  // Bytes of the current IDAT chunk not yet read
+    int idatDone;             // The last IDAT chunk has been read
+    int nextRead;             // The header of the chunk after the image data has been read
+    uint32_t nextLength;
+    uint8_t nextType[4];
+    PngChunk* leading;        // Copied ancillary chunks before the image data (gAMA, sRGB, iCCP, pHYs, text)
+    PngChunk* trailing;       // Ancillary chunks after it, once pngReaderFinish has read them
+    uint8_t* rows[2];         // Filter type byte followed by the row, current and previous
+    int current;
+    uint32_t rowsDecoded;
+    size_t rowOffset;         // Bytes of the current row already handed out
+    int error;
+} PngReader;
+
+// One chunk of filtered rows compressed on a pool thread into a raw deflate stream that
+// continues the previous chunk's stream
+typedef struct {
+    uint8_t* input;           // Filtered rows
+    size_t inputLength;
+    uint8_t* dictionary;      // Tail of the previous chunk
+    size_t dictionaryLength;
+    uint8_t* output;          // Two spare bytes for the zlib header, the deflate data, four for the Adler-32
+    size_t outputLength;      // Deflate data only
+    size_t outputCapacity;
+    uint32_t adler;           // Adler-32 of the input, combined in order by the writer
+    int level;
+    int last;                 // Finishes the deflate stream
+    int active;               // Launched and not yet written
+    int result;
+    z_stream stream;          // Set up once by pngWriterOpen and reset for every chunk
+    int streamReady;
+    WorkerTask task;
+} PngDeflateJob;
+
+// Encodes a flat stream of RGB rows as a PNG, filtering rows as they complete and deflating
+// chunks of them in parallel; memory stays bounded by the jobs in flight
+typedef struct {
+    FILE* file;
+    WorkerPool* workers;
+    uint32_t height;
+    size_t rowBytes;
+    uint8_t* rows[2];         // Raw row being filled and the previous one
+    int current;
+    size_t rowFill;
+    uint32_t rowsWritten;
+    size_t chunkCapacity;     // Filtered bytes per job: whole rows, PNG_DEFLATE_CHUNK or one row
+    PngDeflateJob jobs[PNG_MAX_JOBS];
+    int jobCount;
+    int slot;                 // Job being filled
+    int headerWritten;        // zlib header already emitted with the first IDAT
+    uint32_t adler;
+    int error;
+} PngWriter;
+
+int isPngFile(FILE* file);
+int pngReaderOpen(PngReader* reader, StegoArena* arena, FILE* file);
+size_t pngReaderRead(PngReader* reader, uint8_t* out, size_t length);
+void pngReaderFinish(PngReader* reader);
+void pngReaderClose(PngReader* reader);
+int pngWriterOpen(PngWriter* writer, StegoArena* arena, WorkerPool* workers, FILE* file, uint32_t width, uint32_t height,
+                  int level);
+void pngWriterCopyChunks(PngWriter* writer, const PngChunk* chunks);
+int pngWriterWrite(PngWriter* writer, const uint8_t* data, size_t length);
+int pngWriterClose(PngWriter* writer, const PngChunk* trailing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,290 @@
+#include "scan.h"
+#include "archive.h"
+#include "shard.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A directory to list, or a batch of files to probe
+typedef struct ScanTask {
+    struct ScanTask* next;
+    int directory;
+    int count;
+    char* paths[SCAN_BATCH_SIZE];
+} ScanTask;
+
+// Work shared by all scan workers: a stack of tasks (depth first, so a subtree's files are probed
+// while its directory blocks are still cached) and the running totals
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    ScanTask* tasks;
+    long pending;          // Tasks queued or being worked on; the scan is over when this reaches 0
+    FILE* report;
+    long directories;
+    long files;
+    long candidates;
+    int failed;            // An allocation failed while listing; written under the lock
+} ScanState;
+
+// Queue a task and wake a worker
+static void pushTask(ScanState* state, ScanTask* task) {
+    pthread_mutex_lock(&state->lock);
+    task->next = state->tasks;
+    state->tasks = task;
+    state->pending++;
+    pthread_cond_signal(&state->ready);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Take the next task, waiting while others may still produce one; NULL once the scan is over
+static ScanTask* popTask(ScanState* state) {
+    pthread_mutex_lock(&state->lock);
+    while (!state->tasks && state->pending > 0) {
+        pthread_cond_wait(&state->ready, &state->lock);
+    }
+    ScanTask* task = state->tasks;
+    if (task) {
+        state->tasks = task->next;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return task;
+}
+
+// Mark a task as finished; the last one wakes every worker so they can exit
+static void finishTask(ScanState* state, ScanTask* task) {
+    for (int i = 0; i < task->count; i++) {
+        free(task->paths[i]);
+    }
+    free(task);
+    pthread_mutex_lock(&state->lock);
+    if (--state->pending == 0) {
+        pthread_cond_broadcast(&state->ready);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+// New empty task
+static ScanTask* newTask(int directory) {
+    ScanTask* task = (ScanTask*)calloc(1, sizeof(ScanTask));
+    if (task) {
+        task->directory = directory;
+    }
+    return task;
+}
+
+// Join a directory and an entry name into a new string
+static char* joinPath(const char* directory, const char* name) {
+    size_t length = strlen(directory);
+    int separator = length > 0 && directory[length - 1] != '/';
+    char* path = (char*)malloc(length + separator + strlen(name) + 1);
+    if (path) {
+        memcpy(path, directory, length);
+        if (separator) path[length] = '/';
+        strcpy(path + length + separator, name);
+    }
+    return path;
+}
+
+// List one directory: subdirectories become tasks of their own, regular files are queued in batches
+static void listDirectory(ScanState* state, const char* directoryPath) {
+    DIR* directory = opendir(directoryPath);
+    if (!directory) {
+        fprintf(stderr, "Warning: Unable to open directory: %s\n", directoryPath);
+        return;
+    }
+    ScanTask* batch = NULL;
+    int failed = 0; // Recorded in the state under its lock once the listing ends
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char* path = joinPath(directoryPath, entry->d_name);
+        if (!path) {
+            failed = 1;
+            break;
+        }
+
+        // Use the entry type when the file system provides it; symbolic links are never followed
+        int type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat info;
+            type = lstat(path, &info) != 0 ? DT_UNKNOWN
+                   : S_ISDIR(info.st_mode) ? DT_DIR
+                   : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            ScanTask* task = newTask(1);
+            if (!task) {
+                free(path);
+                failed = 1;
+                break;
+            }
+            task->paths[task->count++] = path;
+            pushTask(state, task);
+        } else if (type == DT_REG) {
+            if (!batch && !(batch = newTask(0))) {
+                free(path);
+                failed = 1;
+                break;
+            }
+            batch->paths[batch->count++] = path;
+            if (batch->count == SCAN_BATCH_SIZE) {
+                pushTask(state, batch);
+                batch = NULL;
+            }
+        } else {
+            free(path);
+        }
+    }
+    if (batch) {
+        pushTask(state, batch);
+    }
+    closedir(directory);
+    pthread_mutex_lock(&state->lock);
+    state->directories++;
+    if (failed) state->failed = 1;
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Read the start of one file and report it when its first pixel holds a valid bit depth and the
+// payload header behind it is one written by this tool
+static void probeFile(ScanState* state, const char* path) {
+    uint8_t bmpHeader[BMP_HEADER_SIZE];
+    uint8_t probe[SCAN_PROBE_SIZE];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    // Read the BMP header, then the start of the pixel data wherever the header puts it
+    struct stat info;
+    ssize_t readCount = -1;
+    long pixelOffset = 0;
+    if (fstat(fd, &info) == 0 && pread(fd, bmpHeader, sizeof(bmpHeader), 0) == (ssize_t)sizeof(bmpHeader) &&
+        bmpHeader[0] == 'B' && bmpHeader[1] == 'M') {
+        pixelOffset = loadUint32(bmpHeader + 10);
+        if (pixelOffset >= BMP_HEADER_SIZE) readCount = pread(fd, probe, sizeof(probe), pixelOffset);
+    }
+    close(fd);
+
+    pthread_mutex_lock(&state->lock);
+    state->files++;
+    pthread_mutex_unlock(&state->lock);
+
+    // Only BMP files with room for the bit-depth pixel and the groups holding the header
+    // The probe starts at the pixel data, so group offsets are taken from a pixel offset of 0
+    int depth = readCount > 0 ? extractBits(probe[0], 4) : 0;
+    int luma = (depth & LUMA_FLAG) != 0;
+    int bits_to_hide = depth & ~LUMA_FLAG;
+    if (readCount < (ssize_t)payloadGroupOffset(0, 0) || bits_to_hide < 1 || bits_to_hide > 4) {
+        return;
+    }
+    // A luma file carries one slot per pixel, 4 per group, instead of 3
+    int slots = luma ? 4 : 3;
+    long groups = (SCAN_HEADER_BYTES * 8 + slots * bits_to_hide - 1) / (slots * bits_to_hide);
+    if (readCount < (ssize_t)payloadGroupOffset(0, groups)) {
+        return;
+    }
+    uint8_t header[SCAN_HEADER_BYTES];
+    decodePayloadPrefix(probe + payloadGroupOffset(0, 0), bits_to_hide, luma, header, sizeof(header));
+
+    // The payload must also fit in the file, which weeds out chance matches
+    long capacity = ((long)info.st_size - payloadGroupOffset(pixelOffset, 0)) / (4 * 3) * slots * bits_to_hide / 8;
+    char detail[64];
+    const char* kind = NULL;
+    if (memcmp(header, PAYLOAD_MAGIC, 4) == 0) {
+        uint32_t length = loadUint32(header + 4);
+        if ((uint64_t)length + PAYLOAD_HEADER_SIZE + PAYLOAD_CHECKSUM_SIZE <= (uint64_t)capacity) {
+            // An archive is a framed payload that starts with the archive header
+            uint32_t count = loadUint32(header + PAYLOAD_HEADER_SIZE + 4);
+            if (memcmp(header + PAYLOAD_HEADER_SIZE, ARCHIVE_MAGIC, 4) == 0 && count > 0 &&
+                (uint64_t)count * 13 + ARCHIVE_HEADER_SIZE <= length) { // Entries are at least 13 bytes
+                kind = "archive";
+                snprintf(detail, sizeof(detail), "%u members", count);
+            } else {
+                kind = "message";
+                snprintf(detail, sizeof(detail), "%u bytes", length);
+            }
+        }
+    } else if (memcmp(header, SHARD_MAGIC, 4) == 0) {
+        uint16_t index = (uint16_t)(header[8] | (header[9] << 8));
+        uint16_t count = (uint16_t)(header[10] | (header[11] << 8));
+        if (index < count) {
+            kind = "shard";
+            snprintf(detail, sizeof(detail), "%u of %u, payload %08x", index + 1, count, loadUint32(header + 4));
+        }
+    }
+    if (!kind) return;
+
+    pthread_mutex_lock(&state->lock);
+    state->candidates++;
+    fprintf(state->report, "%s\t%d bits%s\t%s\t%s\n", path, bits_to_hide, luma ? " luma" : "", kind, detail);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Worker body: run tasks until the whole tree has been listed and probed
+static void* scanWorker(void* argument) {
+    ScanState* state = (ScanState*)argument;
+    ScanTask* task;
+    while ((task = popTask(state)) != NULL) {
+        if (task->directory) {
+            listDirectory(state, task->paths[0]);
+        } else {
+            for (int i = 0; i < task->count; i++) {
+                probeFile(state, task->paths[i]);
+            }
+        }
+        finishTask(state, task);
+    }
+    return NULL;
+}
+
+// Report every BMP under root that carries a payload written by this tool, reading only the first
+// few hundred bytes of each file; directories are listed and files probed by a pool of workers
+int scanDirectory(const char* root, FILE* report) {
+    struct stat info;
+    if (stat(root, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        fprintf(stderr, "Error: Not a directory: %s\n", root);
+        return FILE_ACCESS_ERROR;
+    }
+
+    ScanState state;
+    memset(&state, 0, sizeof(state));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.ready, NULL);
+    state.report = report;
+
+    ScanTask* task = newTask(1);
+    char* path = task ? strdup(root) : NULL;
+    if (!path) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(task);
+        return GENERAL_ERROR;
+    }
+    task->paths[task->count++] = path;
+    pushTask(&state, task);
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = (processors < 1 ? 1 : processors) * SCAN_THREADS_PER_PROCESSOR;
+    if (threads > SCAN_MAX_THREADS) threads = SCAN_MAX_THREADS;
+    pthread_t workers[SCAN_MAX_THREADS];
+    int started = 0;
+    for (long t = 0; t < threads; t++) {
+        if (pthread_create(&workers[started], NULL, scanWorker, &state) == 0) started++;
+    }
+    if (started == 0) {
+        scanWorker(&state); // No threads available: scan on the calling thread
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    pthread_cond_destroy(&state.ready);
+    pthread_mutex_destroy(&state.lock);
+
+    printf("Scanned %ld files in %ld directories: %ld candidates.\n", state.files, state.directories, state.candidates);
+    if (state.failed) {
+        fprintf(stderr, "Memory allocation failed; the scan is incomplete.\n");
+        return GENERAL_ERROR;
+    }
+    return SUCCESSFUL;
+}
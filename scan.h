@@ -0,0 +1,31 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Payload bytes decoded from each file: enough for the longest header checked (archive: the payload
+// frame header, then the archive magic and member count)
+#define SCAN_HEADER_BYTES 16
+// Bytes read from the start of each file's pixel data: the bit-depth pixel and the pixel groups that
+// hold SCAN_HEADER_BYTES at 1 bit per component
+#define SCAN_PROBE_SIZE 1024
+// Files handed to a worker at a time
+#define SCAN_BATCH_SIZE 64
+// Workers mostly wait on the file system, so there are more of them than processors
+#define SCAN_THREADS_PER_PROCESSOR 4
+#define SCAN_MAX_THREADS 64
+
+int scanDirectory(const char* root, FILE* report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,442 @@
+#include "shard.h"
+#include "checksum.h"
+#include "steganography.h"
+#include <pthread.h>
+
+// Work item for one cover (hide) or one stego file (extract)
+typedef struct {
+    const char* imagePath;
+    char outputPath[FILENAME_MAX];
+    OutputFile output;          // Hide: shard written under a temporary name until every shard is done
+    const uint8_t* payload;     // Hide: start of this shard's slice of the payload
+    uint8_t* destination;       // Extract: reassembly buffer
+    uint32_t payloadId;
+    uint16_t index;
+    uint16_t count;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t totalLength;
+    long capacity;
+    int bits_to_hide;
+    int result;
+} ShardJob;
+
+// Jobs shared by the shard workers, handed out in order
+typedef struct {
+    pthread_mutex_t lock;
+    ShardJob* jobs;
+    uint32_t count;
+    uint32_t next;
+    StegoContext* caller;   // Extract: progress is reported to the caller's hook under the lock
+    uint64_t done;          // Extract: payload bytes decoded by all workers
+    uint64_t total;
+} ShardQueue;
+
+// One of a fixed number of workers; each has a context of its own, reused for every job it takes
+typedef struct {
+    ShardQueue* queue;
+    StegoContext context;
+    WorkerTask task;
+} ShardWorker;
+
+// Store a 16-bit value in little-endian order
+static void storeUint16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+}
+
+// Load a 16-bit little-endian value
+static uint16_t loadUint16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+// Split a comma separated list in place; returns the number of entries
+static uint32_t splitList(char* list, const char** entries, uint32_t maxEntries) {
+    uint32_t count = 0;
+    char* start = list;
+    for (char* p = list;; p++) {
+        if (*p == SHARD_LIST_SEPARATOR || *p == '\0') {
+            int last = (*p == '\0');
+            *p = '\0';
+            if (entries && count < maxEntries) entries[count] = start;
+            count++;
+            if (last) break;
+            start = p + 1;
+        }
+    }
+    return count;
+}
+
+// Workers have contexts of their own; they only poll the caller's hook for cancellation
+static int shardProgress(void* progressData, uint64_t done, uint64_t total) {
+    (void)done;
+    (void)total;
+    return stegoReportProgress((StegoContext*)progressData, 0, 0);
+}
+
+// Take the next job from the queue; NULL once every job has been handed out
+static ShardJob* nextShardJob(ShardQueue* queue) {
+    ShardJob* job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next < queue->count) {
+        job = &queue->jobs[queue->next++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Run the jobs on a fixed set of workers from the caller's pool, one per processor and no more than
+// there are jobs, each taking jobs from the queue until none are left
+static int runShardWorkers(StegoContext* context, ShardJob* jobs, uint32_t count, void (*body)(void*)) {
+    uint32_t workerCount = (uint32_t)workerPoolSize(&context->workers);
+    if (workerCount > count) workerCount = count;
+    ShardWorker* workers = (ShardWorker*)calloc(workerCount, sizeof(ShardWorker));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    ShardQueue queue;
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.jobs = jobs;
+    queue.count = count;
+    queue.next = 0;
+    queue.caller = context;
+    queue.done = 0;
+    queue.total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        queue.total += jobs[i].length;
+    }
+
+    for (uint32_t w = 0; w < workerCount; w++) {
+        // Worker contexts take the caller's options; the shards already keep every processor busy,
+        // so each context needs only its band prefetch thread
+        workers[w].queue = &queue;
+        stegoContextInit(&workers[w].context, 0);
+        workers[w].context.workers.limit = 1;
+        workers[w].context.memoryLimit = context->memoryLimit;
+        workers[w].context.pngLevel = context->pngLevel;
+        workers[w].context.constantTime = context->constantTime;
+        workers[w].context.luma = context->luma;
+        if (context->progress) {
+            workers[w].context.progress = shardProgress;
+            workers[w].context.progressData = context;
+        }
+        workerPoolSubmit(&context->workers, &workers[w].task, body, &workers[w]);
+    }
+    for (uint32_t w = 0; w < workerCount; w++) {
+        workerPoolWait(&context->workers, &workers[w].task);
+        stegoContextRelease(&workers[w].context);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    free(workers);
+    return SUCCESSFUL;
+}
+
+// Embed one shard (header, slice of the payload and terminator) into its own cover
+static void hideShard(StegoContext* context, ShardJob* job) {
+    FILE* coverFile = NULL;
+
+    job->result = fileAccessCheck((char*)job->imagePath, &coverFile, READ_FILE);
+    if (job->result) return;
+    job->result = outputFileOpen(&job->output, job->outputPath);
+    if (job->result) {
+        fclose(coverFile);
+        return;
+    }
+
+    // Assemble the shard payload in the worker's arena
+    arenaReset(&context->arena);
+    size_t terminatorLength = strlen(TERMINATOR_SEQUENCE);
+    long shardSize = SHARD_HEADER_SIZE + job->length + terminatorLength;
+    uint8_t* shard = (uint8_t*)arenaAlloc(&context->arena, shardSize);
+    if (!shard) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        job->result = GENERAL_ERROR;
+    } else {
+        memcpy(shard, SHARD_MAGIC, 4);
+        storeUint32(shard + 4, job->payloadId);
+        storeUint16(shard + 8, job->index);
+        storeUint16(shard + 10, job->count);
+        storeUint32(shard + 12, job->offset);
+        storeUint32(shard + 16, job->length);
+        storeUint32(shard + 20, job->totalLength);
+        memcpy(shard + SHARD_HEADER_SIZE, job->payload, job->length);
+        memcpy(shard + SHARD_HEADER_SIZE + job->length, TERMINATOR_SEQUENCE, terminatorLength);
+        job->result = hideBuffer(context, shard, shardSize, coverFile, job->output.file, job->bits_to_hide);
+    }
+
+    fclose(coverFile);
+    if (job->result) {
+        outputFileDiscard(&job->output); // Never leave a half written shard behind
+    }
+}
+
+// Pool task: embed shards until the queue is empty
+static void hideShardWorker(void* argument) {
+    ShardWorker* worker = (ShardWorker*)argument;
+    ShardJob* job;
+    while ((job = nextShardJob(worker->queue)) != NULL) {
+        hideShard(&worker->context, job);
+    }
+}
+
+// Split a payload across several covers and embed the shards in parallel on a fixed set of workers
+int hideShards(StegoContext* context, FILE* inputFile, const char* coverList, const char* outputPrefix, int bits_to_hide) {
+    // Read the whole payload into memory
+    fseek(inputFile, 0, SEEK_END);
+    long inputFileSize = ftell(inputFile);
+    rewind(inputFile);
+    if (inputFileSize < 0 || (unsigned long)inputFileSize > UINT32_MAX) {
+        fprintf(stderr, "Error: Message file is too large to shard.\n");
+        return HIDE_ERROR;
+    }
+    uint8_t* payload = (uint8_t*)malloc(inputFileSize ? inputFileSize : 1);
+    char* covers = (char*)malloc(strlen(coverList) + 1);
+    const char** coverPaths = NULL;
+    ShardJob* jobs = NULL;
+    int result = SUCCESSFUL;
+    if (!payload || !covers) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    fread(payload, 1, inputFileSize, inputFile);
+    strcpy(covers, coverList);
+
+    uint32_t count = splitList(covers, NULL, 0);
+    if (count > SHARD_MAX_COUNT) {
+        fprintf(stderr, "Error: Too many covers (maximum %d).\n", SHARD_MAX_COUNT);
+        result = PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        goto cleanup;
+    }
+    strcpy(covers, coverList);
+    coverPaths = (const char**)calloc(count, sizeof(char*));
+    jobs = (ShardJob*)calloc(count, sizeof(ShardJob));
+    if (!coverPaths || !jobs) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    splitList(covers, coverPaths, count);
+
+    // Fill covers in order, each up to its own capacity minus the shard framing
+    uint32_t payloadId = crc32c(0, payload, inputFileSize);
+    long framing = SHARD_HEADER_SIZE + (long)strlen(TERMINATOR_SEQUENCE);
+    uint32_t assigned = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        FILE* coverFile = NULL;
+        result = fileAccessCheck((char*)coverPaths[i], &coverFile, READ_FILE);
+        if (result) goto cleanup;
+        long capacity = coverCapacity(coverFile, bits_to_hide) - framing;
+        fclose(coverFile);
+
+        long remaining = inputFileSize - assigned;
+        long length = capacity < 0 ? 0 : (capacity < remaining ? capacity : remaining);
+        jobs[i].imagePath = coverPaths[i];
+        int written = snprintf(jobs[i].outputPath, sizeof(jobs[i].outputPath), "%s_%u.bmp", outputPrefix, i);
+        if (written < 0 || (size_t)written >= sizeof(jobs[i].outputPath)) {
+            fprintf(stderr, "Error: Output prefix is too long: %s\n", outputPrefix);
+            result = PARAMETERS_PROVIDED_INCORRECT_ERROR;
+            goto cleanup;
+        }
+        jobs[i].payload = payload + assigned;
+        jobs[i].payloadId = payloadId;
+        jobs[i].index = (uint16_t)i;
+        jobs[i].count = (uint16_t)count;
+        jobs[i].offset = assigned;
+        jobs[i].length = (uint32_t)length;
+        jobs[i].totalLength = (uint32_t)inputFileSize;
+        jobs[i].bits_to_hide = bits_to_hide;
+        assigned += length;
+    }
+    if (assigned < inputFileSize) {
+        fprintf(stderr, "Error: Payload of %ld bytes exceeds the combined capacity of the covers (%u bytes).\n",
+                inputFileSize, assigned);
+        result = CAPACITY_ERROR;
+        goto cleanup;
+    }
+
+    // Embed the shards on the workers
+    result = runShardWorkers(context, jobs, count, hideShardWorker);
+    if (result) goto cleanup;
+    for (uint32_t i = 0; i < count; i++) {
+        if (jobs[i].result && !result) result = jobs[i].result;
+    }
+    // A failed shard makes the whole set useless, so the shards only replace their targets together
+    for (uint32_t i = 0; i < count; i++) {
+        if (!result) {
+            result = outputFileCommit(&jobs[i].output);
+        } else {
+            outputFileDiscard(&jobs[i].output);
+        }
+    }
+    if (!result) {
+        for (uint32_t i = 0; i < count; i++) {
+            printf("Shard %u/%u (%u bytes) hidden in %s.\n", i + 1, count, jobs[i].length, jobs[i].outputPath);
+        }
+    }
+
+cleanup:
+    free(jobs);
+    free(coverPaths);
+    free(covers);
+    free(payload);
+    return result;
+}
+
+// Read and validate the shard header of one stego file
+static int readShardHeader(FILE* stegoFile, ShardJob* job) {
+    int hidden_bits_to_hide = readBitDepth(stegoFile);
+    if (hidden_bits_to_hide > 0 && (hidden_bits_to_hide & LUMA_FLAG)) {
+        fprintf(stderr, "Error: Luma stego files (--luma) are only supported by -extract: %s\n", job->imagePath);
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (hidden_bits_to_hide != job->bits_to_hide) {
+        fprintf(stderr, "Error: Number of bits for extraction does not match the number of bits used for hiding: %s\n",
+                job->imagePath);
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    uint8_t header[SHARD_HEADER_SIZE];
+    int result = readPayload(stegoFile, job->bits_to_hide, 0, header, SHARD_HEADER_SIZE);
+    if (result) return result;
+    if (memcmp(header, SHARD_MAGIC, 4) != 0) {
+        fprintf(stderr, "Error: No shard found in %s\n", job->imagePath);
+        return EXTRACT_ERROR;
+    }
+    job->payloadId = loadUint32(header + 4);
+    job->index = loadUint16(header + 8);
+    job->count = loadUint16(header + 10);
+    job->offset = loadUint32(header + 12);
+    job->length = loadUint32(header + 16);
+    job->totalLength = loadUint32(header + 20);
+    if (job->index >= job->count || (uint64_t)job->offset + job->length > job->totalLength) {
+        fprintf(stderr, "Error: Corrupt shard header in %s\n", job->imagePath);
+        return EXTRACT_ERROR;
+    }
+    return SUCCESSFUL;
+}
+
+// Add decoded bytes to the shared progress and pass it to the caller's hook, one worker at a time;
+// nonzero when the caller asked to cancel
+static int shardAdvance(ShardQueue* queue, uint32_t bytes) {
+    pthread_mutex_lock(&queue->lock);
+    queue->done += bytes;
+    int cancelled = stegoReportProgress(queue->caller, queue->done, queue->total);
+    pthread_mutex_unlock(&queue->lock);
+    return cancelled;
+}
+
+// Decode one shard straight into its place in the reassembly buffer, block by block, which is also
+// where a cancel request takes effect
+static void extractShard(ShardQueue* queue, ShardJob* job) {
+    FILE* stegoFile = NULL;
+    job->result = fileAccessCheck((char*)job->imagePath, &stegoFile, READ_FILE);
+    if (job->result) return;
+    for (uint32_t done = 0; done < job->length && !job->result;) {
+        uint32_t block = job->length - done < PAYLOAD_READ_BLOCK ? job->length - done : PAYLOAD_READ_BLOCK;
+        job->result = readPayload(stegoFile, job->bits_to_hide, SHARD_HEADER_SIZE + (long)done,
+                                  job->destination + job->offset + done, block);
+        done += block;
+        if (!job->result && shardAdvance(queue, block)) {
+            job->result = CANCELLED_ERROR;
+        }
+    }
+    fclose(stegoFile);
+}
+
+// Pool task: decode shards until the queue is empty
+static void extractShardWorker(void* argument) {
+    ShardWorker* worker = (ShardWorker*)argument;
+    ShardJob* job;
+    while ((job = nextShardJob(worker->queue)) != NULL) {
+        extractShard(worker->queue, job);
+    }
+}
+
+// Reassemble a sharded payload from its stego files, given in any order
+int extractShards(StegoContext* context, const char* stegoList, FILE* outputFile, int bits_to_hide) {
+    char* stegos = (char*)malloc(strlen(stegoList) + 1);
+    const char** stegoPaths = NULL;
+    ShardJob* jobs = NULL;
+    uint8_t* payload = NULL;
+    uint8_t* seen = NULL;
+    int result = SUCCESSFUL;
+    if (!stegos) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    strcpy(stegos, stegoList);
+    uint32_t count = splitList(stegos, NULL, 0);
+    strcpy(stegos, stegoList);
+    stegoPaths = (const char**)calloc(count, sizeof(char*));
+    jobs = (ShardJob*)calloc(count, sizeof(ShardJob));
+    if (!stegoPaths || !jobs) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    splitList(stegos, stegoPaths, count);
+
+    // Read every shard header and check they all belong to one complete set
+    for (uint32_t i = 0; i < count; i++) {
+        FILE* stegoFile = NULL;
+        jobs[i].imagePath = stegoPaths[i];
+        jobs[i].bits_to_hide = bits_to_hide;
+        result = fileAccessCheck((char*)stegoPaths[i], &stegoFile, READ_FILE);
+        if (result) goto cleanup;
+        result = readShardHeader(stegoFile, &jobs[i]);
+        fclose(stegoFile);
+        if (result) goto cleanup;
+        if (jobs[i].payloadId != jobs[0].payloadId || jobs[i].count != jobs[0].count ||
+            jobs[i].totalLength != jobs[0].totalLength) {
+            fprintf(stderr, "Error: %s belongs to a different shard set.\n", stegoPaths[i]);
+            result = EXTRACT_ERROR;
+            goto cleanup;
+        }
+    }
+    if (jobs[0].count != count) {
+        fprintf(stderr, "Error: Expected %u shards but %u were provided.\n", jobs[0].count, count);
+        result = EXTRACT_ERROR;
+        goto cleanup;
+    }
+    seen = (uint8_t*)calloc(count, 1);
+    payload = (uint8_t*)malloc(jobs[0].totalLength ? jobs[0].totalLength : 1);
+    if (!seen || !payload) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        result = GENERAL_ERROR;
+        goto cleanup;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (seen[jobs[i].index]) {
+            fprintf(stderr, "Error: Shard %u was provided more than once.\n", jobs[i].index + 1);
+            result = EXTRACT_ERROR;
+            goto cleanup;
+        }
+        seen[jobs[i].index] = 1;
+        jobs[i].destination = payload;
+    }
+
+    // Decode the shards in parallel, each into its own slice of the payload
+    result = runShardWorkers(context, jobs, count, extractShardWorker);
+    if (result) goto cleanup;
+    for (uint32_t i = 0; i < count; i++) {
+        if (jobs[i].result && !result) result = jobs[i].result;
+    }
+    if (result) goto cleanup;
+
+    // The payload id is the checksum of the reassembled payload
+    if (crc32c(0, payload, jobs[0].totalLength) != jobs[0].payloadId) {
+        fprintf(stderr, "Error: Reassembled payload does not match its checksum.\n");
+        result = EXTRACT_ERROR;
+        goto cleanup;
+    }
+    fwrite(payload, 1, jobs[0].totalLength, outputFile);
+
+cleanup:
+    free(seen);
+    free(payload);
+    free(jobs);
+    free(stegoPaths);
+    free(stegos);
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shard payload layout (all integers little-endian):
+//   "SSHD" | uint32 payload id | uint16 shard index | uint16 shard count
+//   | uint32 offset in payload | uint32 shard length | uint32 total payload length
+//   | shard data
+// The payload id is the CRC32C of the whole payload and doubles as its integrity check.
+#define SHARD_MAGIC "SSHD"
+#define SHARD_HEADER_SIZE 24
+#define SHARD_MAX_COUNT 65535
+#define SHARD_LIST_SEPARATOR ','
+#define DEFAULT_SHARD_OUTPUT_PREFIX "output_shard"
+
+int hideShards(StegoContext* context, FILE* inputFile, const char* coverList, const char* outputPrefix, int bits_to_hide);
+int extractShards(StegoContext* context, const char* stegoList, FILE* outputFile, int bits_to_hide);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,255 +1,793 @@
 #include "steganography.h"
 #include "utils.h"
+#include "checksum.h"
+#include "tiles.h"
+#include "pngcodec.h"
+#include <limits.h>
+
+// Prepare a context; large scratch buffers are backed by huge pages when hugePages is set
+void stegoContextInit(StegoContext* context, int hugePages) {
+    arenaInit(&context->arena, hugePages);
+    workerPoolInit(&context->workers);
+    context->memoryLimit = DEFAULT_MEMORY_LIMIT;
+    context->pngLevel = DEFAULT_PNG_LEVEL;
+    context->constantTime = 0;
+    context->luma = 0;
+    context->progress = NULL;
+    context->progressData = NULL;
+}
+
+// Stop the context's threads and release all memory it holds
+void stegoContextRelease(StegoContext* context) {
+    workerPoolRelease(&context->workers);
+    arenaRelease(&context->arena);
+}
+
+// Pass progress to the caller's hook, if any; nonzero when the caller asked to cancel
+int stegoReportProgress(StegoContext* context, uint64_t done, uint64_t total) {
+    return context->progress && context->progress(context->progressData, done, total);
+}
 
 // Cross-reference pixel values between original and stego files
-int crossReferencePixels(FILE* originalFile, FILE* stegoFile, long imageSize) {
-    // Allocate memory to hold pixel data from original and stego files
-    uint8_t* originalPixels = (uint8_t*)malloc(imageSize);
-    uint8_t* stegoPixels = (uint8_t*)malloc(imageSize);
+int crossReferencePixels(StegoContext* context, FILE* originalFile, FILE* stegoFile, long imageSize) {
+    // Stream both files in lockstep bands; four band buffers share the memory budget
+    arenaReset(&context->arena);
+    long bandSize = bandSizeFor(context->memoryLimit, 4, 4 * 3);
+    BandReader originalReader, stegoReader;
+    int originalReady =
+        bandReaderInit(&originalReader, &context->arena, &context->workers, originalFile, imageSize, bandSize);
+    int stegoReady =
+        originalReady && bandReaderInit(&stegoReader, &context->arena, &context->workers, stegoFile, imageSize, bandSize);
 
     // Check if memory allocation was successful
-    if (!originalPixels || !stegoPixels) {
-        // If not, print an error message and free any allocated memory
+    if (!originalReady || !stegoReady) {
         fprintf(stderr, "Memory allocation failed.\n");
-        free(originalPixels);
-        free(stegoPixels);
+        if (originalReady) bandReaderClose(&originalReader);
         return GENERAL_ERROR;
     }
 
-    // Read pixel data from original and stego files into allocated memory
-    fread(originalPixels, 1, imageSize, originalFile);
-    fread(stegoPixels, 1, imageSize, stegoFile);
+    long index = 0;
+    uint8_t* originalPixels;
+    uint8_t* stegoPixels;
+    size_t originalLength, stegoLength;
+    while ((originalLength = bandReaderNext(&originalReader, &originalPixels)) > 0 &&
+           (stegoLength = bandReaderNext(&stegoReader, &stegoPixels)) > 0) {
+        // Loop through each pixel of the band and compare the values
+        size_t length = originalLength < stegoLength ? originalLength : stegoLength;
+        for (size_t i = 0; i < length; i++) {
+            // If a mismatch is found, print the details
+            if (originalPixels[i] != stegoPixels[i]) {
+                fprintf(stderr, "Pixel mismatch at index %ld: original = %d, stego = %d\n", index + (long)i,
+                        originalPixels[i], stegoPixels[i]);
+            }
+        }
+        index += length;
+    }
+    bandReaderClose(&originalReader);
+    bandReaderClose(&stegoReader);
+
+    // Return success
+    return SUCCESSFUL;
+}
 
-    // Loop through each pixel and compare the values
-    for (long i = 0; i < imageSize; i++) {
-        // If a mismatch is found, print the details
-        if (originalPixels[i] != stegoPixels[i]) {
-            fprintf(stderr, "Pixel mismatch at index %ld: original = %d, stego = %d\n", i, originalPixels[i], stegoPixels[i]);
+// Running checksum over the data section of a framed payload, filled in ahead of the packing loop
+typedef struct {
+    long next;      // First data byte not yet folded into the checksum
+    long end;       // End of the data section; the checksum trailer is stored here
+    uint32_t crc;
+} PayloadDigest;
+
+static int embedPayload(StegoContext* context, uint8_t* inputData, long totalInputSize, FILE* coverFile,
+                        FILE* outputFile, int bits_to_hide, PayloadDigest* digest);
+
+// Fold the next block of payload data into the checksum once packing reaches it, and seal the
+// trailer as soon as the last data byte has been folded (always before packing reaches the trailer)
+static void digestAhead(uint8_t* inputData, long byteIndex, PayloadDigest* digest) {
+    if (byteIndex < digest->next) return;
+    if (digest->next < digest->end) {
+        long chunk = digest->end - digest->next;
+        if (chunk > PAYLOAD_DIGEST_BLOCK) chunk = PAYLOAD_DIGEST_BLOCK;
+        digest->crc = crc32c(digest->crc, inputData + digest->next, chunk);
+        digest->next += chunk;
+    }
+    if (digest->next >= digest->end) {
+        storeUint32(inputData + digest->end, digest->crc);
+        digest->next = LONG_MAX; // Nothing left to digest
+    }
+}
+
+// Pixel data of a cover or stego image as one flat stream of bytes: the rows after the BMP header
+// read ahead in bands, or the decoded rows of a PNG
+typedef struct {
+    int isPng;
+    BandReader bands;     // BMP
+    PngReader png;        // PNG
+    uint8_t* buffer;      // PNG band buffer
+    size_t bandSize;
+    long groups;          // Full 4-pixel groups after the first pixel
+    uint64_t length;      // Bytes of pixel data after the first pixel, for progress
+    uint8_t* headerRest;  // BMP: bytes between the 54-byte header and the pixel data
+    size_t headerRestLength;
+} PixelSource;
+
+// Open the pixel data of an image and read its first pixel (which holds the bit depth)
+static int pixelSourceOpen(PixelSource* source, StegoContext* context, FILE* file, uint8_t* header, uint8_t* bits_pixel) {
+    source->isPng = isPngFile(file);
+    if (source->isPng) {
+        int result = pngReaderOpen(&source->png, &context->arena, file);
+        if (result) return result;
+        // Bands of about one row, in whole 4-pixel groups: memory stays a few rows for any image size
+        source->bandSize = (source->png.rowBytes + 4 * 3 - 1) / (4 * 3) * (4 * 3);
+        source->buffer = (uint8_t*)arenaAlloc(&context->arena, source->bandSize);
+        if (!source->buffer) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            pngReaderClose(&source->png);
+            return GENERAL_ERROR;
         }
+        source->length = (uint64_t)source->png.rowBytes * source->png.height - 3;
+        source->groups = (long)(source->length / (4 * 3));
+        if (pngReaderRead(&source->png, bits_pixel, 3) < 3) {
+            fprintf(stderr, "Error: File contains no pixel data.\n");
+            pngReaderClose(&source->png);
+            return GENERAL_ERROR;
+        }
+        return SUCCESSFUL;
     }
 
-    // Free the allocated memory
-    free(originalPixels);
-    free(stegoPixels);
+    // Read and check the BMP header, then the first pixel
+    if (fread(header, 1, BMP_HEADER_SIZE, file) < BMP_HEADER_SIZE) {
+        fprintf(stderr, "Error: File contains no pixel data.\n");
+        return GENERAL_ERROR;
+    }
+    int result = checkBmpHeader(header, file);
+    if (result) return result;
+    // Keep whatever lies between the header and the pixel data (a larger info header, color masks)
+    // so it can be copied to the output unchanged
+    source->headerRestLength = loadUint32(header + 10) - BMP_HEADER_SIZE;
+    source->headerRest = (uint8_t*)arenaAlloc(&context->arena, source->headerRestLength ? source->headerRestLength : 1);
+    if (!source->headerRest) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    if (fread(source->headerRest, 1, source->headerRestLength, file) < source->headerRestLength ||
+        fread(bits_pixel, 1, 3, file) < 3) {
+        fprintf(stderr, "Error: File contains no pixel data.\n");
+        return GENERAL_ERROR;
+    }
 
-    // Return success
+    // Read the rest in bands of whole rows within the memory budget, prefetching the next band
+    long position = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long remaining = ftell(file) - position;
+    fseek(file, position, SEEK_SET);
+    source->groups = remaining / (4 * 3);
+    source->length = remaining < 0 ? 0 : (uint64_t)remaining;
+    if (!bandReaderInit(&source->bands, &context->arena, &context->workers, file, remaining,
+                        bandSizeFor(context->memoryLimit, 2, bmpRowStride(header)))) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
     return SUCCESSFUL;
 }
 
-// Hide data within a BMP file
-int hideData(FILE* inputFile, FILE* coverFile, FILE* outputFile, int bits_to_hide) {
+// Number of payload bytes (terminator included) that fit in the pixel groups of an open image; in
+// luma mode each of the 4 pixels carries a slot instead of each of the 3 average components
+static long pixelSourceCapacity(PixelSource* source, int bits_to_hide, int luma) {
+    return source->groups * (luma ? 4 : 3) * bits_to_hide / 8;
+}
+
+// Hand out the next band of pixel data (valid until the following call); returns 0 at the end
+static size_t pixelSourceNext(PixelSource* source, uint8_t** band) {
+    if (source->isPng) {
+        *band = source->buffer;
+        return pngReaderRead(&source->png, source->buffer, source->bandSize);
+    }
+    return bandReaderNext(&source->bands, band);
+}
+
+// Stop reading; returns the decoder's error for a PNG that ended badly
+static int pixelSourceClose(PixelSource* source) {
+    if (source->isPng) {
+        pngReaderClose(&source->png);
+        return source->png.error;
+    }
+    bandReaderClose(&source->bands);
+    return SUCCESSFUL;
+}
+
+// Position of the packing loop in the payload
+typedef struct {
+    uint8_t* inputData;
+    long totalBitsToHide;
+    long bitsHidden;
+    int bits_to_hide;
+    PayloadDigest* digest;
+    int constantTime;      // Use the constant-time kernel
+    int luma;              // One slot in the luma of each pixel
+    int rgb;               // Pixels are stored R, G, B (PNG) rather than B, G, R (BMP)
+} EmbedCursor;
+
+// Take the next slot of payload bits; with 3 bits per slot a slot may straddle two bytes, and past
+// the end of the payload it is padded with zeros
+static uint8_t nextSlot(EmbedCursor* cursor) {
+    long byteIndex = cursor->bitsHidden / 8;
+    int bitOffset = cursor->bitsHidden % 8;
+    digestAhead(cursor->inputData, byteIndex, cursor->digest);
+    unsigned window = (unsigned)cursor->inputData[byteIndex] << 8;
+    if (bitOffset + cursor->bits_to_hide > 8 && (byteIndex + 1) * 8 < cursor->totalBitsToHide) {
+        digestAhead(cursor->inputData, byteIndex + 1, cursor->digest);
+        window |= cursor->inputData[byteIndex + 1];
+    }
+    cursor->bitsHidden += cursor->bits_to_hide;
+    return (window >> (16 - cursor->bits_to_hide - bitOffset)) & ((1 << cursor->bits_to_hide) - 1);
+}
+
+// Hide the next bits of the payload in one group of 4 pixels (12 bytes)
+static void embedGroup(uint8_t* pixels, EmbedCursor* cursor) {
+    // In luma mode each pixel takes a slot on its own; pixels past the end of the payload are left untouched
+    if (cursor->luma) {
+        for (int i = 0; i < 4 && cursor->bitsHidden < cursor->totalBitsToHide; ++i) {
+            embedLuma(pixels + i * 3, cursor->bits_to_hide, nextSlot(cursor), cursor->rgb);
+        }
+        return;
+    }
+
+    // Calculate the average color of the pixels
+    uint8_t avg[3];
+    averageColors(avg, pixels);
+
+    // Prepare to hide bits in the average color; components past the end of the payload keep the
+    // bits they already carry, so they are left untouched
+    uint8_t bits[3];
+    for (int i = 0; i < 3; ++i) {
+        bits[i] = extractBits(avg[i], cursor->bits_to_hide);
+    }
+    for (int i = 0; i < 3 && cursor->bitsHidden < cursor->totalBitsToHide; ++i) {
+        bits[i] = nextSlot(cursor);
+    }
+
+    // Distribute the modified average color back to the pixels in place
+    if (cursor->constantTime) {
+        distributeAverageConstantTime(avg, pixels, cursor->bits_to_hide, bits);
+    } else {
+        distributeAverage(avg, pixels, cursor->bits_to_hide, bits);
+    }
+}
+
+// Read a message file into a framed payload: header (magic and data length), data, checksum
+// trailer (filled in by the packing loop) and terminator sequence
+uint8_t* loadPayload(StegoContext* context, FILE* inputFile, long* totalInputSize) {
     // Move the file pointer to the end of the input file to get its size
     fseek(inputFile, 0, SEEK_END);
     long inputFileSize = ftell(inputFile);
     rewind(inputFile); // Move the file pointer back to the beginning
+    if (inputFileSize < 0 || (unsigned long)inputFileSize > UINT32_MAX) {
+        fprintf(stderr, "Error: Message file is too large.\n");
+        return NULL;
+    }
 
-    // Calculate the total input size including the terminator sequence
+    // Calculate the total input size including the framing and terminator sequence
     size_t terminatorLength = strlen(TERMINATOR_SEQUENCE);
-    long totalInputSize = inputFileSize + terminatorLength;
+    *totalInputSize = PAYLOAD_HEADER_SIZE + inputFileSize + PAYLOAD_CHECKSUM_SIZE + terminatorLength;
 
-    // Allocate memory to hold the input data and terminator sequence
-    uint8_t* inputData = (uint8_t*)malloc(totalInputSize);
+    // Allocate memory to hold the framed input data from the context's scratch arena
+    uint8_t* inputData = (uint8_t*)arenaAlloc(&context->arena, *totalInputSize);
     if (!inputData) {
         // If memory allocation fails, print an error message
         fprintf(stderr, "Memory allocation failed.\n");
+        return NULL;
+    }
+
+    // Write the header, read the input data behind it and append the empty trailer and terminator
+    memcpy(inputData, PAYLOAD_MAGIC, 4);
+    storeUint32(inputData + 4, (uint32_t)inputFileSize);
+    fread(inputData + PAYLOAD_HEADER_SIZE, 1, inputFileSize, inputFile);
+    memset(inputData + PAYLOAD_HEADER_SIZE + inputFileSize, 0, PAYLOAD_CHECKSUM_SIZE);
+    memcpy(inputData + PAYLOAD_HEADER_SIZE + inputFileSize + PAYLOAD_CHECKSUM_SIZE, TERMINATOR_SEQUENCE, terminatorLength);
+    return inputData;
+}
+
+// Compute the checksum trailer of a framed payload up front (for callers that do not pack it)
+void sealPayload(uint8_t* inputData) {
+    uint32_t dataLength = loadUint32(inputData + 4);
+    storeUint32(inputData + PAYLOAD_HEADER_SIZE + dataLength, crc32c(0, inputData + PAYLOAD_HEADER_SIZE, dataLength));
+}
+
+// Hide data within a BMP file
+int hideData(StegoContext* context, FILE* inputFile, FILE* coverFile, FILE* outputFile, int bits_to_hide) {
+    // Scratch memory from the previous call is reused
+    arenaReset(&context->arena);
+    long totalInputSize = 0;
+    uint8_t* inputData = loadPayload(context, inputFile, &totalInputSize);
+    if (!inputData) {
         return GENERAL_ERROR;
     }
 
-    // Read the input data into memory
-    fread(inputData, 1, inputFileSize, inputFile);
-    // Append the terminator sequence to the input data
-    memcpy(inputData + inputFileSize, TERMINATOR_SEQUENCE, terminatorLength);
+    // Embed the framed payload; its checksum is computed inline by the packing loop
+    PayloadDigest digest = { PAYLOAD_HEADER_SIZE, PAYLOAD_HEADER_SIZE + (long)loadUint32(inputData + 4), 0 };
+    return embedPayload(context, inputData, totalInputSize, coverFile, outputFile, bits_to_hide, &digest);
+}
+
+// Hide an in-memory payload (terminator already appended) within a BMP file
+int hideBuffer(StegoContext* context, const uint8_t* inputData, long totalInputSize, FILE* coverFile, FILE* outputFile,
+               int bits_to_hide) {
+    // Without a digest the packing loop never writes to the payload. The arena is not reset here, so
+    // inputData may come from it; callers reset it before building the payload.
+    // Archives and shards are read back with random access into the BMP pixel data, 3 slots per group
+    if (isPngFile(coverFile)) {
+        fprintf(stderr, "Error: PNG images are only supported by -hide and -extract.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (context->luma) {
+        fprintf(stderr, "Error: --luma is only supported by -hide and -extract.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    return embedPayload(context, (uint8_t*)inputData, totalInputSize, coverFile, outputFile, bits_to_hide, NULL);
+}
 
-    // Read the BMP header from the cover file
-    uint8_t header[54];
-    fread(header, 1, 54, coverFile);
-    // Write the BMP header to the output file
-    fwrite(header, 1, 54, outputFile);
+// Pack a payload into the 4-pixel groups of a cover, optionally checksumming it on the way. The
+// output has the cover's format: BMP covers are copied band by band, PNG covers are decoded and
+// re-encoded a row at a time.
+static int embedPayload(StegoContext* context, uint8_t* inputData, long totalInputSize, FILE* coverFile,
+                        FILE* outputFile, int bits_to_hide, PayloadDigest* digest) {
+    PayloadDigest noDigest = { LONG_MAX, 0, 0 };
+    if (!digest) {
+        digest = &noDigest;
+    }
 
-    // Read the first pixel from the cover file
+    // Read the header (BMP) and the first pixel from the cover file
+    uint8_t header[BMP_HEADER_SIZE];
     uint8_t bits_pixel[3];
-    fread(bits_pixel, 1, 3, coverFile);
-    // Store the number of bits to hide in the first pixel
-    bits_pixel[0] = embedBits(bits_pixel[0], bits_to_hide, 4); // Store in the least significant 4 bits
-    // Write the modified first pixel to the output file
-    fwrite(bits_pixel, 1, 3, outputFile);
-
-    // Calculate the total number of bits to hide
-    int totalBitsToHide = totalInputSize * 8;
-    int bitsHidden = 0;
-
-    // Loop until all bits are hidden
-    while (bitsHidden < totalBitsToHide) {
-        // Read 4 pixels (12 bytes) from the cover file
-        uint8_t pixels[4 * 3]; // Always 4 pixels
-        size_t readCount = fread(pixels, 1, 4 * 3, coverFile);
-        if (readCount < 4 * 3) {
-            // Handle insufficient pixels
-            if (readCount >= 3) {
-                // Calculate the average color of the pixels
-                uint8_t avg[3];
-                averageColors(avg, pixels);
-
-                // Prepare to hide bits in the average color
-                uint8_t bits[3];
-                for (int i = 0; i < 3 && bitsHidden < totalBitsToHide; ++i) {
-                    int byteIndex = bitsHidden / 8;
-                    int bitOffset = bitsHidden % 8;
-                    // Extract the bits to hide from the input data
-                    bits[i] = (inputData[byteIndex] >> (8 - bits_to_hide - bitOffset)) & ((1 << bits_to_hide) - 1);
-                    bitsHidden += bits_to_hide;
-                }
+    PixelSource source;
+    int result = pixelSourceOpen(&source, context, coverFile, header, bits_pixel);
+    if (result) return result;
+
+    // Refuse payloads that do not fit instead of silently truncating them at the last pixel
+    long capacity = pixelSourceCapacity(&source, bits_to_hide, context->luma);
+    if (totalInputSize > capacity) {
+        fprintf(stderr, "Error: Payload of %ld bytes exceeds the cover capacity of %ld bytes.\n", totalInputSize, capacity);
+        pixelSourceClose(&source);
+        return CAPACITY_ERROR;
+    }
 
-                // Distribute the modified average color back to the pixels
-                distributeAverage(avg, pixels, bits_to_hide, bits);
-                // Write the modified pixels to the output file
-                fwrite(pixels, 1, readCount, outputFile);
-            }
-            break;
+    PngWriter png;
+    if (source.isPng) {
+        // Same dimensions as the cover, encoded at the configured zlib level
+        result = pngWriterOpen(&png, &context->arena, &context->workers, outputFile, source.png.width, source.png.height,
+                               context->pngLevel);
+        if (result) {
+            pixelSourceClose(&source);
+            return result;
         }
+        // Keep the cover's color space, resolution and text chunks
+        pngWriterCopyChunks(&png, source.png.leading);
+    } else {
+        // Write the BMP header, and anything between it and the pixel data, to the output file
+        fwrite(header, 1, BMP_HEADER_SIZE, outputFile);
+        fwrite(source.headerRest, 1, source.headerRestLength, outputFile);
+    }
 
-        // Calculate the average color of the pixels
-        uint8_t avg[3];
-        averageColors(avg, pixels);
+    // Store the number of bits to hide in the first pixel, flagged when the slots are in the luma
+    bits_pixel[0] = embedBits(bits_pixel[0], bits_to_hide | (context->luma ? LUMA_FLAG : 0), 4); // Store in the least significant 4 bits
+    // Write the modified first pixel to the output file
+    if (source.isPng) {
+        pngWriterWrite(&png, bits_pixel, 3);
+    } else {
+        fwrite(bits_pixel, 1, 3, outputFile);
+    }
 
-        // Prepare to hide bits in the average color
-        uint8_t bits[3];
-        for (int i = 0; i < 3 && bitsHidden < totalBitsToHide; ++i) {
-            int byteIndex = bitsHidden / 8;
-            int bitOffset = bitsHidden % 8;
-            // Extract the bits to hide from the input data
-            bits[i] = (inputData[byteIndex] >> (8 - bits_to_hide - bitOffset)) & ((1 << bits_to_hide) - 1);
-            bitsHidden += bits_to_hide;
+    // Track the total number of bits to hide
+    EmbedCursor cursor = { inputData, totalInputSize * 8, 0, bits_to_hide, digest, context->constantTime, context->luma,
+                           source.isPng };
+
+    // Stream the rest of the cover through band by band, so (for a BMP) the next band is already
+    // being read while the current one is embedded and written
+    uint8_t* band;
+    size_t bandLength;
+    uint64_t done = 0;
+    int cancelled = 0;
+    while ((bandLength = pixelSourceNext(&source, &band)) > 0) {
+        // Loop over the full groups of 4 pixels (12 bytes) in the band until all bits are hidden
+        for (size_t offset = 0; offset + 4 * 3 <= bandLength && cursor.bitsHidden < cursor.totalBitsToHide; offset += 4 * 3) {
+            embedGroup(band + offset, &cursor);
         }
 
-        // Distribute the modified average color back to the pixels
-        distributeAverage(avg, pixels, bits_to_hide, bits);
-        // Write the modified pixels to the output file
-        fwrite(pixels, 1, 4 * 3, outputFile);
-    }
+        // Write the band, modified or not, to the output file
+        if (source.isPng) {
+            pngWriterWrite(&png, band, bandLength);
+        } else {
+            fwrite(band, 1, bandLength, outputFile);
+        }
 
-    // Write any remaining data from the cover file to the output file
-    uint8_t buffer[1024];
-    size_t bytesRead;
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), coverFile)) > 0) {
-        fwrite(buffer, 1, bytesRead, outputFile);
+        // Report once per band, which is also where a cancel request takes effect (while work remains)
+        done += bandLength;
+        if (stegoReportProgress(context, done, source.length) && done < source.length) {
+            cancelled = 1;
+            break;
+        }
     }
-
-    // Free the allocated memory for input data
-    free(inputData);
-    return SUCCESSFUL;
+    if (source.isPng && !cancelled) {
+        pngReaderFinish(&source.png);
+    }
+    result = pixelSourceClose(&source);
+    if (source.isPng) {
+        int writeResult = pngWriterClose(&png, source.png.trailing);
+        if (!result) result = writeResult;
+    }
+    // The caller discards the partial output
+    return cancelled ? CANCELLED_ERROR : result;
 }
 
-// Extract hidden data from a BMP file
-int extractData(FILE* stegoFile, FILE* outputFile, int bits_to_hide) {
-    // Read the BMP header from the stego file
-    uint8_t header[54];
-    fread(header, 1, 54, stegoFile);
+// Compare two buffers in time that depends only on their length (memcmp stops at the first difference)
+static int constantTimeEqual(const uint8_t* a, const uint8_t* b, size_t length) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < length; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
 
-    // Read the first pixel from the stego file
+// Extract hidden data from a BMP or PNG file
+int extractData(StegoContext* context, FILE* stegoFile, FILE* outputFile, int bits_to_hide) {
+    // Open the pixel data of the stego file and read its first pixel
+    arenaReset(&context->arena);
+    uint8_t header[BMP_HEADER_SIZE];
     uint8_t bits_pixel[3];
-    fread(bits_pixel, 1, 3, stegoFile);
-    // Extract the number of bits used for hiding from the first pixel
+    PixelSource source;
+    int result = pixelSourceOpen(&source, context, stegoFile, header, bits_pixel);
+    if (result) return result;
+    // Extract the number of bits used for hiding from the first pixel, and whether they are in the luma
     int hidden_bits_to_hide = extractBits(bits_pixel[0], 4);
+    int luma = (hidden_bits_to_hide & LUMA_FLAG) != 0;
+    hidden_bits_to_hide &= ~LUMA_FLAG;
 
     // Check if the provided bits_to_hide matches the hidden_bits_to_hide
     if (bits_to_hide != hidden_bits_to_hide) {
         fprintf(stderr, "Error: Number of bits for extraction does not match the number of bits used for hiding.\n");
+        pixelSourceClose(&source);
         return PARAMETERS_PROVIDED_INCORRECT_ERROR;
     }
 
     // Initialize variables for extracting data
     const int BITS_IN_BYTE = 8;
-    int bitsExtracted = 0;
+    // Counted in 64 bits like the pixel data, as a large cover holds more than 2^31 bits
+    uint64_t bitsExtracted = 0;
     size_t extractedSize = 0;
     size_t allocatedSize = 1024;
-    // Allocate memory to hold the extracted data
-    uint8_t* extractedData = (uint8_t*)malloc(allocatedSize);
+    // Allocate memory to hold the extracted data from the context's scratch arena
+    uint8_t* extractedData = (uint8_t*)arenaAlloc(&context->arena, allocatedSize);
     if (!extractedData) {
         fprintf(stderr, "Memory allocation failed.\n");
+        pixelSourceClose(&source);
         return GENERAL_ERROR;
     }
 
+    // Framed payloads (see loadPayload) carry their length and a checksum that is verified on the fly
+    int framed = -1; // Unknown until the payload header has been extracted
+    size_t dataLength = 0;
+    uint64_t payloadEnd = 0;
+    size_t digested = PAYLOAD_HEADER_SIZE;
+    uint32_t crc = 0;
+    // Unframed payloads end at the terminator; bytes before checkedBytes have been checked for it
+    size_t terminatorLength = strlen(TERMINATOR_SEQUENCE);
+    size_t checkedBytes = 0;
+
+    // Pixel data arrives in bands of whole 4-pixel groups
+    uint8_t* band = NULL;
+    size_t bandLength = 0;
+    size_t bandOffset = 0;
+    uint64_t done = 0;
+
     // Loop until all bits are extracted
     while (1) {
-        // Read 4 pixels (12 bytes) from the stego file
-        uint8_t pixels[4 * 3]; // Always 4 pixels
-        size_t readCount = fread(pixels, 1, 4 * 3, stegoFile);
-        if (readCount < 4 * 3) {
-            // Handle insufficient pixels
-            if (readCount >= 3) {
-                for (int i = 0; i < 3; ++i) {
-                    if (bitsExtracted % BITS_IN_BYTE == 0) {
-                        if (extractedSize >= allocatedSize) {
-                            // Reallocate memory if needed
-                            allocatedSize *= 2;
-                            extractedData = (uint8_t*)realloc(extractedData, allocatedSize);
-                            if (!extractedData) {
-                                fprintf(stderr, "Memory reallocation failed.\n");
-                                free(extractedData);
-                                return GENERAL_ERROR;
-                            }
+        // Take the next 4 pixels (12 bytes) from the current band, moving to the next band when it is used up
+        if (bandOffset >= bandLength) {
+            // Report once per band, which is also where a cancel request takes effect
+            done += bandLength;
+            if (stegoReportProgress(context, done, source.length)) {
+                pixelSourceClose(&source);
+                return CANCELLED_ERROR;
+            }
+            bandLength = pixelSourceNext(&source, &band);
+            bandOffset = 0;
+        }
+        // A trailing partial group never carries data (embedding skips it), so extraction stops there
+        if (bandLength - bandOffset < 4 * 3) {
+            break;
+        }
+        uint8_t* pixels = band + bandOffset;
+        bandOffset += 4 * 3;
+
+        // Slots are the luma of each pixel, or the components of the average color of the pixels
+        uint8_t slots[4];
+        int slotCount = luma ? 4 : 3;
+        if (luma) {
+            for (int i = 0; i < 4; ++i) {
+                slots[i] = pixelLuma(pixels + i * 3, source.isPng);
+            }
+        } else {
+            averageColors(slots, pixels);
+        }
+
+        for (int i = 0; i < slotCount; ++i) {
+            // Slots are appended MSB first; with 3 bits per slot one may straddle two bytes
+            for (int remaining = bits_to_hide; remaining > 0;) {
+                int bitOffset = bitsExtracted % BITS_IN_BYTE;
+                if (bitOffset == 0) {
+                    if (extractedSize >= allocatedSize) {
+                        // Grow the buffer if needed (in place while it is the newest arena allocation)
+                        extractedData = (uint8_t*)arenaGrow(&context->arena, extractedData, allocatedSize, allocatedSize * 2);
+                        allocatedSize *= 2;
+                        if (!extractedData) {
+                            fprintf(stderr, "Memory reallocation failed.\n");
+                            pixelSourceClose(&source);
+                            return GENERAL_ERROR;
                         }
-                        // Initialize a new byte for extracted data
-                        extractedData[extractedSize] = 0;
-                        extractedSize++;
                     }
-
-                    // Extract the bits from the pixel and store them in the extracted data
-                    int shift = BITS_IN_BYTE - bitsExtracted % BITS_IN_BYTE - bits_to_hide;
-                    uint8_t bits = extractBits(pixels[i], bits_to_hide) << shift;
-                    extractedData[extractedSize - 1] |= bits;
-                    bitsExtracted += bits_to_hide;
+                    // Initialize a new byte for extracted data
+                    extractedData[extractedSize] = 0;
+                    extractedSize++;
                 }
+
+                // Extract the bits from the average color and store them in the extracted data
+                int take = remaining < BITS_IN_BYTE - bitOffset ? remaining : BITS_IN_BYTE - bitOffset;
+                uint8_t bits = (extractBits(slots[i], bits_to_hide) >> (remaining - take)) & ((1 << take) - 1);
+                extractedData[extractedSize - 1] |= bits << (BITS_IN_BYTE - bitOffset - take);
+                bitsExtracted += take;
+                remaining -= take;
             }
-            break;
         }
 
-        // Calculate the average color of the pixels
-        uint8_t avg[3];
-        averageColors(avg, pixels);
-
-        for (int i = 0; i < 3; ++i) {
-            if (bitsExtracted % BITS_IN_BYTE == 0) {
-                if (extractedSize >= allocatedSize) {
-                    // Reallocate memory if needed
-                    allocatedSize *= 2;
-                    extractedData = (uint8_t*)realloc(extractedData, allocatedSize);
+        // Once the payload header is complete, check whether the payload is framed
+        uint64_t completeBytes = bitsExtracted / BITS_IN_BYTE;
+        if (framed < 0 && completeBytes >= PAYLOAD_HEADER_SIZE) {
+            framed = (memcmp(extractedData, PAYLOAD_MAGIC, 4) == 0);
+            if (framed) {
+                dataLength = loadUint32(extractedData + 4);
+                payloadEnd = (uint64_t)PAYLOAD_HEADER_SIZE + dataLength + PAYLOAD_CHECKSUM_SIZE;
+                // A damaged length must not drive the buffer size past what the image can hold
+                if (payloadEnd > (uint64_t)pixelSourceCapacity(&source, bits_to_hide, luma)) {
+                    fprintf(stderr, "Error: Hidden data extends past the end of the image.\n");
+                    pixelSourceClose(&source);
+                    return EXTRACT_ERROR;
+                }
+                // The length is known now, so grow the buffer once (a group may start two more bytes)
+                if (payloadEnd + 2 > allocatedSize) {
+                    extractedData = (uint8_t*)arenaGrow(&context->arena, extractedData, allocatedSize, (size_t)payloadEnd + 2);
+                    allocatedSize = (size_t)payloadEnd + 2;
                     if (!extractedData) {
                         fprintf(stderr, "Memory reallocation failed.\n");
-                        free(extractedData);
+                        pixelSourceClose(&source);
                         return GENERAL_ERROR;
                     }
                 }
-                // Initialize a new byte for extracted data
-                extractedData[extractedSize] = 0;
-                extractedSize++;
             }
-
-            // Extract the bits from the average color and store them in the extracted data
-            int shift = BITS_IN_BYTE - bitsExtracted % BITS_IN_BYTE - bits_to_hide;
-            uint8_t bits = extractBits(avg[i], bits_to_hide) << shift;
-            extractedData[extractedSize - 1] |= bits;
-            bitsExtracted += bits_to_hide;
         }
 
-        // Check if the terminator sequence is reached
-        if (extractedSize >= strlen(TERMINATOR_SEQUENCE)) {
-            if (memcmp(extractedData + extractedSize - strlen(TERMINATOR_SEQUENCE), TERMINATOR_SEQUENCE, strlen(TERMINATOR_SEQUENCE)) == 0) {
-                // Remove the terminator sequence from the extracted data
-                extractedSize -= strlen(TERMINATOR_SEQUENCE);
+        if (framed > 0) {
+            // Fold completed data bytes into the checksum in blocks while they are still in cache
+            size_t dataEnd = PAYLOAD_HEADER_SIZE + dataLength;
+            size_t ready = completeBytes < dataEnd ? (size_t)completeBytes : dataEnd;
+            if (ready > digested && (ready - digested >= PAYLOAD_DIGEST_BLOCK || ready == dataEnd)) {
+                crc = crc32c(crc, extractedData + digested, ready - digested);
+                digested = ready;
+            }
+            // Stop as soon as the checksum trailer has been extracted; the terminator is not needed
+            if (completeBytes >= payloadEnd) {
                 break;
             }
+            continue;
+        }
+
+        // Check if the terminator sequence is reached, at the end of every byte completed by this group
+        // (a group can complete two bytes, and the last byte started may still be partial)
+        int terminated = 0;
+        for (; checkedBytes < completeBytes && !terminated; checkedBytes++) {
+            size_t end = checkedBytes + 1;
+            if (end >= terminatorLength &&
+                constantTimeEqual(extractedData + end - terminatorLength, (const uint8_t*)TERMINATOR_SEQUENCE, terminatorLength)) {
+                // Remove the terminator sequence (and anything after it) from the extracted data
+                extractedSize = end - terminatorLength;
+                terminated = 1;
+            }
+        }
+        if (terminated) {
+            break;
+        }
+    }
+
+    result = pixelSourceClose(&source);
+    if (result) return result;
+    // Extraction stops at the end of the payload, which completes the operation
+    stegoReportProgress(context, source.length, source.length);
+
+    if (framed > 0) {
+        // A framed payload must be complete and match its checksum
+        if (bitsExtracted / BITS_IN_BYTE < payloadEnd) {
+            fprintf(stderr, "Error: Hidden data extends past the end of the image.\n");
+            return EXTRACT_ERROR;
+        }
+        if (crc != loadUint32(extractedData + PAYLOAD_HEADER_SIZE + dataLength)) {
+            fprintf(stderr, "Error: Extracted data does not match its checksum.\n");
+            return INTEGRITY_ERROR;
         }
+        fwrite(extractedData + PAYLOAD_HEADER_SIZE, 1, dataLength, outputFile);
+        return SUCCESSFUL;
     }
 
     // Write the extracted data to the output file
     fwrite(extractedData, 1, extractedSize, outputFile);
-    // Free the allocated memory for extracted data
-    free(extractedData);
+    // The buffer stays in the arena for the next call
+    return SUCCESSFUL;
+}
+
+// Read a range of hidden payload bytes, seeking straight to the pixel group that holds them
+int readPayload(FILE* stegoFile, int bits_to_hide, long offset, uint8_t* out, size_t length) {
+    // Locate the slot (one averaged color component) holding the first requested bit
+    long bitPosition = offset * 8;
+    long slot = bitPosition / bits_to_hide;
+    int skipBits = bitPosition % bits_to_hide;
+    long group = slot / 3;
+    int channel = slot % 3;
+
+    // Jump past the header, the bit-depth pixel and all preceding groups
+    long pixelOffset = bmpPixelOffset(stegoFile);
+    if (pixelOffset < 0 || fseek(stegoFile, payloadGroupOffset(pixelOffset, group), SEEK_SET) != 0) {
+        return EXTRACT_ERROR;
+    }
+
+    memset(out, 0, length);
+    size_t bitsWanted = length * 8;
+    size_t bitsRead = 0;
+    while (bitsRead < bitsWanted) {
+        // Read the next 4 pixels (12 bytes) and average them
+        uint8_t pixels[4 * 3];
+        if (fread(pixels, 1, 4 * 3, stegoFile) < 4 * 3) {
+            fprintf(stderr, "Error: Hidden data extends past the end of the image.\n");
+            return EXTRACT_ERROR;
+        }
+        uint8_t avg[3];
+        averageColors(avg, pixels);
+
+        for (; channel < 3 && bitsRead < bitsWanted; ++channel) {
+            uint8_t value = extractBits(avg[channel], bits_to_hide);
+            int bitOffset = bitsRead % 8;
+            if (!skipBits && bitOffset + bits_to_hide <= 8 && bitsRead + bits_to_hide <= bitsWanted) {
+                // The whole slot lands inside one output byte
+                out[bitsRead / 8] |= value << (8 - bitOffset - bits_to_hide);
+                bitsRead += bits_to_hide;
+                continue;
+            }
+            // Otherwise copy the slot one bit at a time
+            for (int b = bits_to_hide - 1 - skipBits; b >= 0 && bitsRead < bitsWanted; --b) {
+                if ((value >> b) & 1) {
+                    out[bitsRead / 8] |= 0x80 >> (bitsRead % 8);
+                }
+                bitsRead++;
+            }
+            skipBits = 0;
+        }
+        channel = 0;
+    }
+    return SUCCESSFUL;
+}
+
+// Decode the first payload bytes from an in-memory copy of the BMP pixel groups, starting at group 0;
+// with luma set the slots are the luma of each pixel instead of the group's average color
+void decodePayloadPrefix(const uint8_t* groups, int bits_to_hide, int luma, uint8_t* out, size_t length) {
+    memset(out, 0, length);
+    size_t bitsWanted = length * 8;
+    size_t bitsRead = 0;
+    int slotCount = luma ? 4 : 3;
+    for (const uint8_t* pixels = groups; bitsRead < bitsWanted; pixels += 4 * 3) {
+        uint8_t slots[4];
+        if (luma) {
+            for (int i = 0; i < 4; ++i) {
+                slots[i] = pixelLuma(pixels + i * 3, 0);
+            }
+        } else {
+            averageColors(slots, (uint8_t*)pixels);
+        }
+        for (int slot = 0; slot < slotCount; ++slot) {
+            // Copy the slot one bit at a time, MSB first, dropping bits past the end
+            uint8_t value = extractBits(slots[slot], bits_to_hide);
+            for (int b = bits_to_hide - 1; b >= 0 && bitsRead < bitsWanted; --b, ++bitsRead) {
+                out[bitsRead / 8] |= ((value >> b) & 1) << (7 - bitsRead % 8);
+            }
+        }
+    }
+}
+
+// Number of payload bytes (terminator included) that fit in the pixel groups of a cover file
+long coverCapacity(FILE* coverFile, int bits_to_hide) {
+    // Measure the file without disturbing the current read position
+    long position = ftell(coverFile);
+    fseek(coverFile, 0, SEEK_END);
+    long fileSize = ftell(coverFile);
+    long pixelOffset = bmpPixelOffset(coverFile);
+    fseek(coverFile, position, SEEK_SET);
+
+    long groups = pixelOffset < 0 ? 0 : (fileSize - payloadGroupOffset(pixelOffset, 0)) / (4 * 3);
+    if (groups <= 0) {
+        return 0;
+    }
+    return groups * 3 * bits_to_hide / 8;
+}
+
+// Check that a header describes an uncompressed 24-bit BMP whose pixel data lies inside the file.
+// The kernels and the row stride assume 3-byte pixels, so 32-bit and BITFIELDS images are refused.
+// Pixel data starts at the offset in the header, which is past 54 bytes for V4/V5 headers.
+int checkBmpHeader(const uint8_t* header, FILE* file) {
+    long position = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, position, SEEK_SET);
+
+    uint32_t pixelOffset = loadUint32(header + 10);
+    uint32_t infoSize = loadUint32(header + 14);
+    int32_t width = (int32_t)loadUint32(header + 18);
+    int32_t height = (int32_t)loadUint32(header + 22);
+    int bitCount = header[28] | (header[29] << 8);
+    uint32_t compression = loadUint32(header + 30);
+    if (header[0] != 'B' || header[1] != 'M' || infoSize < 40) {
+        fprintf(stderr, "Error: File is not a BMP image.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (bitCount != 24 || compression != 0) {
+        fprintf(stderr, "Error: Only uncompressed 24-bit BMP images are supported.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (width <= 0 || height == 0 || height == INT32_MIN || pixelOffset < BMP_HEADER_SIZE ||
+        pixelOffset > (uint64_t)fileSize) {
+        fprintf(stderr, "Error: BMP header is damaged.\n");
+        return GENERAL_ERROR;
+    }
     return SUCCESSFUL;
 }
 
+// Read the number of bits used for hiding from the first pixel of a stego file (-1 when the file is
+// not a usable BMP)
+int readBitDepth(FILE* stegoFile) {
+    uint8_t bits_pixel[3];
+    if (bmpPixelOffset(stegoFile) < 0 || fread(bits_pixel, 1, 3, stegoFile) < 3) {
+        return -1;
+    }
+    return extractBits(bits_pixel[0], 4);
+}
+
+// Read and check the header of a BMP file, leaving the file at its pixel data; returns the offset of
+// the pixel data, or -1 when the file is not a usable BMP
+long bmpPixelOffset(FILE* file) {
+    uint8_t header[BMP_HEADER_SIZE];
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(header, 1, BMP_HEADER_SIZE, file) < BMP_HEADER_SIZE ||
+        checkBmpHeader(header, file) != SUCCESSFUL) {
+        return -1;
+    }
+    long pixelOffset = loadUint32(header + 10);
+    if (fseek(file, pixelOffset, SEEK_SET) != 0) {
+        return -1;
+    }
+    return pixelOffset;
+}
+
+// File offset of the given 4-pixel payload group (after the pixel data offset and the bit-depth pixel)
+long payloadGroupOffset(long pixelOffset, long group) {
+    return pixelOffset + 3 + group * 4 * 3;
+}
+
+// Store a 32-bit value in little-endian order
+void storeUint32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+// Load a 32-bit little-endian value
+uint32_t loadUint32(const uint8_t* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
 // Embed the given bits into the color component
 uint8_t embedBits(uint8_t color, uint8_t bits, uint8_t num_bits) {
     // Clear the least significant bits in the color component
@@ -281,61 +819,200 @@ void averageColors(uint8_t* avg, uint8_t* pixels) {
     avg[2] = b / 4;
 }
 
-// Distribute the average color with embedded bits to the pixels
+// Largest change of a 4-pixel component sum needed to reach a sum that carries the wanted bits
+#define MAX_SUM_ADJUSTMENT 64
+
+// For each bit depth, the change that moves a component sum to the nearest sum whose average
+// carries the wanted bits, indexed by the sum's position in the repeating pattern of valid sums
+static int8_t targetTable[4][4 << 4];
+// The most even split of a sum change over the 4 pixels, indexed by the change
+static int8_t splitTable[2 * MAX_SUM_ADJUSTMENT + 1][4];
+// Shard covers are embedded on several threads at once, so the tables are built exactly once
+static pthread_once_t adjustTablesOnce = PTHREAD_ONCE_INIT;
+
+// Build the adjustment tables on first use
+static void buildAdjustTables(void) {
+    for (int b = 1; b <= 4; b++) {
+        // Sums 4a..4a+3 all average to a, so valid sums come in runs of 4 every 4 << b
+        int period = 4 << b;
+        for (int position = 0; position < period; position++) {
+            int down = position <= 3 ? 0 : 3 - position;  // Back to the end of the current run
+            int up = period - position;                   // Forward to the start of the next run
+            targetTable[b - 1][position] = (int8_t)(position <= 3 || -down < up ? down : up);
+        }
+    }
+    for (int diff = -MAX_SUM_ADJUSTMENT; diff <= MAX_SUM_ADJUSTMENT; diff++) {
+        int sign = diff < 0 ? -1 : 1;
+        int magnitude = diff * sign;
+        for (int i = 0; i < 4; i++) {
+            // Every pixel moves by a quarter; the first ones take the remainder
+            splitTable[diff + MAX_SUM_ADJUSTMENT][i] = (int8_t)(sign * (magnitude / 4 + (i < magnitude % 4)));
+        }
+    }
+}
+
+// Spread a sum change over one component of 4 pixels without leaving [0, 255]: pixels move one
+// step at a time in turn, skipping those at the limit, which keeps the squared error minimal
+static void waterFill(uint8_t* component, int diff) {
+    int sign = diff < 0 ? -1 : 1;
+    int remaining = diff * sign;
+    int room[4], step[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        room[i] = sign > 0 ? 255 - component[i * 3] : component[i * 3];
+    }
+    while (remaining > 0) {
+        int given = 0;
+        for (int i = 0; i < 4 && remaining > 0; i++) {
+            if (step[i] < room[i]) {
+                step[i]++;
+                remaining--;
+                given++;
+            }
+        }
+        if (!given) break; // Cannot happen: every target sum lies in [0, 1020]
+    }
+    for (int i = 0; i < 4; i++) {
+        component[i * 3] += sign * step[i];
+    }
+}
+
+// Distribute the average color with embedded bits to the pixels. Each component sum moves to the
+// nearest sum whose average carries the bits, and the change is split as evenly as the [0, 255]
+// range allows, which is the least squared error that reaches it.
 void distributeAverage(uint8_t* avg, uint8_t* pixels, int bits_to_hide, uint8_t* bits) {
-    // Embed the desired bits into the average color
-    for (int i = 0; i < 3; ++i) {
-        avg[i] = embedBits(avg[i], bits[i], bits_to_hide);
+    pthread_once(&adjustTablesOnce, buildAdjustTables);
+    int period = 4 << bits_to_hide;
+    const int8_t* targets = targetTable[bits_to_hide - 1];
+
+    for (int c = 0; c < 3; ++c) {
+        int p0 = pixels[c], p1 = pixels[c + 3], p2 = pixels[c + 6], p3 = pixels[c + 9];
+        int sum = p0 + p1 + p2 + p3;
+
+        // Nearest sum whose average ends in the wanted bits, kept inside [0, 1020] (no branches): past
+        // either end, the nearest one is the other way, from the start of the run above to the end of
+        // the run below or back, which are period - 3 apart
+        int diff = targets[(sum - 4 * bits[c]) & (period - 1)];
+        int target = sum + diff;
+        diff -= (period - 3) & -(target > 4 * 255);
+        diff += (period - 3) & -(target < 0);
+        avg[c] = (uint8_t)((sum + diff) / 4);
+
+        // Even split, unless a pixel would leave the valid range
+        const int8_t* split = splitTable[diff + MAX_SUM_ADJUSTMENT];
+        int q0 = p0 + split[0], q1 = p1 + split[1], q2 = p2 + split[2], q3 = p3 + split[3];
+        if (((q0 | q1 | q2 | q3) & ~255) == 0) {
+            pixels[c] = (uint8_t)q0;
+            pixels[c + 3] = (uint8_t)q1;
+            pixels[c + 6] = (uint8_t)q2;
+            pixels[c + 9] = (uint8_t)q3;
+        } else {
+            waterFill(pixels + c, diff);
+        }
     }
+}
 
-    // Calculate the target sum for each color component
-    int targetR = avg[0] * 4;
-    int targetG = avg[1] * 4;
-    int targetB = avg[2] * 4;
+// Fixed-point BT.601 luma weights in 1/256ths (they add up to 256), indexed B, G, R. The products are
+// computed per pixel rather than looked up, so there is no shared table for shard threads to race on.
+static const uint16_t lumaWeights[3] = { 29, 150, 77 };
 
-    // Initialize variables for the current sum of color components
-    int currentR = 0, currentG = 0, currentB = 0;
+// Luma of one pixel, Y = (77R + 150G + 29B + 128) >> 8, for B, G, R (BMP) or R, G, B (PNG) order
+uint8_t pixelLuma(const uint8_t* pixel, int rgb) {
+    return (uint8_t)((lumaWeights[rgb ? 2 : 0] * pixel[0] + lumaWeights[1] * pixel[1] + lumaWeights[rgb ? 0 : 2] * pixel[2] + 128) >> 8);
+}
 
-    // Calculate the current sum of color components
-    for (int i = 0; i < 4 * 3; i += 3) {
-        currentR += pixels[i];
-        currentG += pixels[i + 1];
-        currentB += pixels[i + 2];
+// Luma of a pixel after adding d to every channel, clamped to [0, 255]
+static int shiftedLuma(const uint8_t* pixel, int d, int rgb) {
+    uint8_t shifted[3];
+    for (int c = 0; c < 3; c++) {
+        int v = pixel[c] + d;
+        shifted[c] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
     }
+    return pixelLuma(shifted, rgb);
+}
 
-    // Calculate the difference needed to adjust the average
-    int diffR = targetR - currentR;
-    int diffG = targetG - currentG;
-    int diffB = targetB - currentB;
-
-    // Adjust the pixels to achieve the desired average
-    adjustPixels(pixels, 0, diffR);
-    adjustPixels(pixels, 1, diffG);
-    adjustPixels(pixels, 2, diffB);
+// Hide bits in the luma of one pixel by adding the same amount to all three channels. Since the
+// weights add up to 256 this moves the luma by exactly that amount and leaves Cb and Cr unchanged,
+// so the pixel gets lighter or darker without any color shift. Only a clamped channel breaks the
+// gray shift; the luma still rises by at most 1 per step, so stepping on reaches the target.
+void embedLuma(uint8_t* pixel, int bits_to_hide, uint8_t bits, int rgb) {
+    int y = pixelLuma(pixel, rgb);
+    int period = 1 << bits_to_hide;
+
+    // Nearest luma that ends in the wanted bits, inside [0, 255]
+    int target = (y & ~(period - 1)) | bits;
+    if (target - y > period / 2 && target - period >= 0) {
+        target -= period;
+    } else if (y - target > period / 2 && target + period <= 255) {
+        target += period;
+    }
+    if (target == y) return;
+
+    // Unclamped, the shift is the luma difference itself
+    int d = target - y;
+    int reached = shiftedLuma(pixel, d, rgb);
+    while (reached < target) reached = shiftedLuma(pixel, ++d, rgb);
+    while (reached > target) reached = shiftedLuma(pixel, --d, rgb);
+    for (int c = 0; c < 3; c++) {
+        int v = pixel[c] + d;
+        pixel[c] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
 }
 
-// Adjust pixel values to achieve the desired average with embedded bits
-void adjustPixels(uint8_t* pixels, int component_index, int diff) {
-    int totalAdjustment = 0;
-    for (int i = 0; i < 4 * 3; i += 3) {
-        // Calculate the adjustment needed for each pixel
-        int adjustment = diff / 4;
-        if (i / 3 < diff % 4) {
-            adjustment += (diff > 0) ? 1 : -1;
+// Branch-free minimum of two ints
+#define CONSTANT_TIME_MIN(a, b) ((b) ^ (((a) ^ (b)) & -((a) < (b))))
+
+// Same result as distributeAverage, computed without branches or table lookups that depend on the
+// pixels or the hidden bits: the target comes from arithmetic masks, and the water-filling level
+// from a fixed 7-step search over [0, 127] instead of a loop that stops early
+void distributeAverageConstantTime(uint8_t* avg, uint8_t* pixels, int bits_to_hide, uint8_t* bits) {
+    int period = 4 << bits_to_hide;
+
+    for (int c = 0; c < 3; ++c) {
+        int p[4] = { pixels[c], pixels[c + 3], pixels[c + 6], pixels[c + 9] };
+        int sum = p[0] + p[1] + p[2] + p[3];
+
+        // Nearest sum whose average ends in the wanted bits: back to the end of the current run of
+        // valid sums or forward to the start of the next, whichever is closer, kept inside [0, 1020]
+        int position = (sum - 4 * bits[c]) & (period - 1);
+        int down = 3 - position;
+        int up = period - position;
+        int diff = (up ^ ((up ^ down) & -(-down < up))) & -(position > 3);
+        int target = sum + diff;
+        diff -= (period - 3) & -(target > 4 * 255);
+        diff += (period - 3) & -(target < 0);
+        avg[c] = (uint8_t)((sum + diff) >> 2);
+
+        // Work on magnitudes: room is the distance to 255 when increasing, to 0 when decreasing
+        int negative = -(diff < 0);
+        int magnitude = (diff ^ negative) - negative;
+        int room[4];
+        for (int i = 0; i < 4; i++) {
+            room[i] = (255 - p[i]) ^ (((255 - p[i]) ^ p[i]) & negative);
+        }
+
+        // Highest level every pixel can be raised to (capped by its room) within the magnitude
+        int level = 0;
+        for (int bit = 64; bit > 0; bit >>= 1) {
+            int candidate = level + bit;
+            int filled = 0;
+            for (int i = 0; i < 4; i++) {
+                filled += CONSTANT_TIME_MIN(room[i], candidate);
+            }
+            level += bit & -(filled <= magnitude);
+        }
+
+        // The remainder goes one step each to the first pixels that still have room
+        int steps[4];
+        int extra = magnitude;
+        for (int i = 0; i < 4; i++) {
+            steps[i] = CONSTANT_TIME_MIN(room[i], level);
+            extra -= steps[i];
         }
-        // Adjust the pixel value
-        pixels[i + component_index] += adjustment;
-        totalAdjustment += adjustment;
-    }
-
-    // Calculate the final adjustment needed
-    int finalAdjustment = diff - totalAdjustment;
-    if (finalAdjustment != 0) {
-        // Apply the final adjustment to the remaining pixels
-        for (int i = 0; i < 4 * 3; i += 3) {
-            if (finalAdjustment == 0) break;
-            pixels[i + component_index] += (finalAdjustment > 0) ? 1 : -1;
-            finalAdjustment += (finalAdjustment > 0) ? -1 : 1;
+        for (int i = 0; i < 4; i++) {
+            int give = 1 & -(room[i] > level) & -(extra > 0);
+            steps[i] += give;
+            extra -= give;
+            pixels[c + 3 * i] = (uint8_t)(p[i] + ((steps[i] ^ negative) - negative));
         }
     }
 }
@@ -7,20 +7,70 @@
 #include <stdint.h>
 #include <string.h>
 #include "utils.h"
+#include "arena.h"
+#include "workers.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-int hideData(FILE* inputFile, FILE* coverFile, FILE* outputFile, int bits_to_hide);
-int extractData(FILE* stegoFile, FILE* outputFile, int bits_to_hide);
-int crossReferencePixels(FILE* originalFile, FILE* stegoFile, long imageSize);
+#define BMP_HEADER_SIZE 54
 
+// Framed payload written by hideData: magic | uint32 data length | data | uint32 CRC32C of data | terminator
+#define PAYLOAD_MAGIC "SGP1"
+#define PAYLOAD_HEADER_SIZE 8
+#define PAYLOAD_CHECKSUM_SIZE 4
+#define PAYLOAD_DIGEST_BLOCK 4096
+// Bytes decoded between progress reports when a payload range is read with random access
+#define PAYLOAD_READ_BLOCK (64 * 1024)
+
+// Set in the bit-depth nibble of the first pixel when each pixel's luma carries a slot (--luma)
+#define LUMA_FLAG 8
+
+// Called once per block of pixel data with the bytes processed so far and in total (total is 0 when
+// the caller can only poll); a nonzero return cancels the operation, which fails with CANCELLED_ERROR
+typedef int (*StegoProgress)(void* progressData, uint64_t done, uint64_t total);
+
+// Per-caller state for the embed/extract engines; not thread-safe, use one per thread
+typedef struct {
+    StegoArena arena;    // Scratch memory reused across calls
+    WorkerPool workers;  // Threads reused across calls for prefetching and parallel work
+    size_t memoryLimit;  // Budget for image data buffers (--mem-limit)
+    int pngLevel;        // zlib level for PNG output (--png-level)
+    int constantTime;    // Use the constant-time embedding kernel (--constant-time)
+    int luma;            // Embed in the luma of each pixel instead of the group's average color (--luma)
+    StegoProgress progress;  // Optional progress and cancellation hook
+    void* progressData;
+} StegoContext;
+
+void stegoContextInit(StegoContext* context, int hugePages);
+void stegoContextRelease(StegoContext* context);
+int stegoReportProgress(StegoContext* context, uint64_t done, uint64_t total);
+
+int hideData(StegoContext* context, FILE* inputFile, FILE* coverFile, FILE* outputFile, int bits_to_hide);
+uint8_t* loadPayload(StegoContext* context, FILE* inputFile, long* totalInputSize);
+void sealPayload(uint8_t* inputData);
+int hideBuffer(StegoContext* context, const uint8_t* inputData, long totalInputSize, FILE* coverFile, FILE* outputFile,
+               int bits_to_hide);
+int extractData(StegoContext* context, FILE* stegoFile, FILE* outputFile, int bits_to_hide);
+int crossReferencePixels(StegoContext* context, FILE* originalFile, FILE* stegoFile, long imageSize);
+void decodePayloadPrefix(const uint8_t* groups, int bits_to_hide, int luma, uint8_t* out, size_t length);
+int readPayload(FILE* stegoFile, int bits_to_hide, long offset, uint8_t* out, size_t length);
+long coverCapacity(FILE* coverFile, int bits_to_hide);
+int checkBmpHeader(const uint8_t* header, FILE* file);
+int readBitDepth(FILE* stegoFile);
+long bmpPixelOffset(FILE* file);
+long payloadGroupOffset(long pixelOffset, long group);
+
+void storeUint32(uint8_t* out, uint32_t value);
+uint32_t loadUint32(const uint8_t* in);
 uint8_t embedBits(uint8_t color, uint8_t bits, uint8_t num_bits);
 uint8_t extractBits(uint8_t color, uint8_t num_bits);
 void averageColors(uint8_t* avg, uint8_t* pixels);
 void distributeAverage(uint8_t* avg, uint8_t* pixels, int bits_to_hide, uint8_t* bits);
-void adjustPixels(uint8_t* pixels, int component_index, int diff);
+void distributeAverageConstantTime(uint8_t* avg, uint8_t* pixels, int bits_to_hide, uint8_t* bits);
+uint8_t pixelLuma(const uint8_t* pixel, int rgb);
+void embedLuma(uint8_t* pixel, int bits_to_hide, uint8_t bits, int rgb);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,132 @@
+// Checks that repeated hide, extract and analyze calls on one context reach a steady state with no
+// heap allocations at all: after a warm-up, every buffer must come from the arena and every thread
+// from the context's worker pool. malloc and friends are replaced below to count calls (glibc only).
+//
+// Build and run from the repository root:
+//   gcc -O2 -I. -o alloc_test test/alloc_test.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./alloc_test
+
+#include "steganography.h"
+#include "analysis.h"
+#include "bench.h"
+#include "pngcodec.h"
+
+// Warm-up calls let the arena settle on its largest block and the pool start its threads
+#define WARMUP_ROUNDS 3
+#define MEASURED_ROUNDS 20
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void __libc_free(void* pointer);
+
+static int counting = 0;
+static unsigned long heapAllocations = 0;
+
+// Counting replacements for the allocator, used by this program, zlib and the C library alike
+void* malloc(size_t size) {
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) __atomic_fetch_add(&heapAllocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) __atomic_fetch_add(&heapAllocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) __atomic_fetch_add(&heapAllocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+
+// Write a PNG cover with the library's own encoder
+static int writePngCover(StegoContext* context, FILE* file, uint32_t width, uint32_t height) {
+    PngWriter writer;
+    arenaReset(&context->arena);
+    int result = pngWriterOpen(&writer, &context->arena, &context->workers, file, width, height, 6);
+    uint8_t row[3 * 512];
+    for (uint32_t y = 0; y < height && !result; y++) {
+        for (uint32_t x = 0; x < width * 3; x++) {
+            row[x] = (uint8_t)((x * 7 + y * 3) ^ (x * y >> 4));
+        }
+        result = pngWriterWrite(&writer, row, width * 3);
+    }
+    int closeResult = pngWriterClose(&writer, NULL);
+    return result ? result : closeResult;
+}
+
+// One round of every steady-state operation; nonzero on the first failure
+static int runRound(StegoContext* context, FILE* payload, FILE* cover, FILE* pngCover, FILE* stego, FILE* sink) {
+    FILE* files[] = { payload, cover, pngCover, stego, sink };
+    int detected = 0;
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) rewind(files[i]);
+    if (hideData(context, payload, cover, stego, 2)) return 1;
+    rewind(stego);
+    if (extractData(context, stego, sink, 2)) return 2;
+    rewind(stego);
+    rewind(cover);
+    if (analyzeImage(context, stego, cover, &detected)) return 3;
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) rewind(files[i]);
+    if (hideData(context, payload, pngCover, stego, 3)) return 4;
+    rewind(stego);
+    if (extractData(context, stego, sink, 3)) return 5;
+    return 0;
+}
+
+int main(void) {
+    StegoContext context;
+    stegoContextInit(&context, 0);
+    // A small budget forces several bands per image, so band prefetching is exercised too
+    context.memoryLimit = 64 * 1024;
+
+    FILE* payload = tmpfile();
+    FILE* cover = tmpfile();
+    FILE* pngCover = tmpfile();
+    FILE* stego = tmpfile();
+    FILE* sink = tmpfile();
+    if (!payload || !cover || !pngCover || !stego || !sink || generatePayload(payload, 12000, 7) ||
+        generateCover(cover, 301, 257, BENCH_NOISE, 11) || writePngCover(&context, pngCover, 300, 257)) {
+        fprintf(stderr, "alloc_test: unable to create the test files\n");
+        return 1;
+    }
+    // analyzeImage prints a report every round
+    if (!freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "alloc_test: unable to silence the analysis reports\n");
+        return 1;
+    }
+
+    for (int round = 0; round < WARMUP_ROUNDS; round++) {
+        int failed = runRound(&context, payload, cover, pngCover, stego, sink);
+        if (failed) {
+            fprintf(stderr, "alloc_test: warm-up step %d failed\n", failed);
+            return 1;
+        }
+    }
+
+    unsigned long blocksBefore = context.arena.blockAllocations;
+    __atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+    for (int round = 0; round < MEASURED_ROUNDS; round++) {
+        int failed = runRound(&context, payload, cover, pngCover, stego, sink);
+        if (failed) {
+            __atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+            fprintf(stderr, "alloc_test: step %d failed in round %d\n", failed, round);
+            return 1;
+        }
+    }
+    __atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+    unsigned long blocks = context.arena.blockAllocations - blocksBefore;
+    unsigned long allocations = __atomic_load_n(&heapAllocations, __ATOMIC_RELAXED);
+
+    stegoContextRelease(&context);
+    fprintf(stderr, "alloc_test: %d rounds, %lu heap allocations, %lu new arena blocks\n", MEASURED_ROUNDS, allocations, blocks);
+    if (allocations || blocks) {
+        fprintf(stderr, "alloc_test: FAILED, the steady state must not allocate\n");
+        return 1;
+    }
+    fprintf(stderr, "alloc_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Checks that the constant-time embedding kernel (--constant-time) has no timing that depends on the
+// pixels or the hidden bits, in the style of dudect: batches of groups from two classes, saturated
+// pixels with bits that force the clamped path and random pixels with random bits, are timed in
+// random order, and Welch's t-test compares the two timing distributions. The fast kernel is
+// measured the same way for comparison (it is expected to leak). Both kernels are then benchmarked
+// on the same groups, and must produce the same pixels.
+//
+// Build and run from the repository root:
+//   gcc -O2 -I. -o timing_test test/timing_test.c $(ls *.c | grep -v main.c) -lpthread -lz -lm && ./timing_test
+
+#include "steganography.h"
+#include <math.h>
+#include <time.h>
+
+// Timed batches per kernel, and groups embedded in each batch
+#define TIMING_MEASUREMENTS 200000
+#define TIMING_BATCH 64
+// Above this |t| dudect reports a definite leak
+#define TIMING_T_THRESHOLD 10.0
+// Measurements above this percentile are dropped, as they are mostly interrupts and preemption
+#define TIMING_CROP_PERCENT 90
+// Groups embedded by each kernel in the benchmark
+#define BENCH_GROUPS (4 * 1000 * 1000)
+#define BITS_TO_HIDE 2
+
+typedef void (*Kernel)(uint8_t* avg, uint8_t* pixels, int bits_to_hide, uint8_t* bits);
+
+static uint32_t randomState = 7;
+
+static uint32_t nextRandom(void) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static uint64_t nanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int compareTimes(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Welch's t statistic between the timings of the two classes, after cropping the slowest ones
+static double timingLeak(Kernel kernel, uint64_t* times, uint8_t* classes) {
+    uint8_t pixels[TIMING_BATCH * 4 * 3];
+    uint8_t bits[TIMING_BATCH][3];
+    for (int m = 0; m < TIMING_MEASUREMENTS; m++) {
+        // Inputs are prepared outside the timed region
+        int random = nextRandom() & 1;
+        for (int i = 0; i < TIMING_BATCH * 4 * 3; i++) {
+            pixels[i] = random ? (uint8_t)nextRandom() : (uint8_t)(254 + (i & 1));
+        }
+        for (int g = 0; g < TIMING_BATCH; g++) {
+            for (int c = 0; c < 3; c++) {
+                bits[g][c] = random ? nextRandom() & ((1 << BITS_TO_HIDE) - 1) : 0;
+            }
+        }
+
+        uint8_t avg[3];
+        uint64_t start = nanoseconds();
+        for (int g = 0; g < TIMING_BATCH; g++) {
+            kernel(avg, pixels + g * 4 * 3, BITS_TO_HIDE, bits[g]);
+        }
+        times[m] = nanoseconds() - start;
+        classes[m] = (uint8_t)random;
+    }
+
+    // Crop at the percentile of both classes together
+    uint64_t* sorted = (uint64_t*)malloc(TIMING_MEASUREMENTS * sizeof(uint64_t));
+    if (!sorted) return INFINITY;
+    memcpy(sorted, times, TIMING_MEASUREMENTS * sizeof(uint64_t));
+    qsort(sorted, TIMING_MEASUREMENTS, sizeof(uint64_t), compareTimes);
+    uint64_t crop = sorted[(long)TIMING_MEASUREMENTS * TIMING_CROP_PERCENT / 100];
+    free(sorted);
+
+    // Running means and variances (Welford)
+    double count[2] = { 0, 0 }, mean[2] = { 0, 0 }, squares[2] = { 0, 0 };
+    for (int m = 0; m < TIMING_MEASUREMENTS; m++) {
+        if (times[m] > crop) continue;
+        int k = classes[m];
+        double delta = (double)times[m] - mean[k];
+        count[k] += 1;
+        mean[k] += delta / count[k];
+        squares[k] += delta * ((double)times[m] - mean[k]);
+    }
+    if (count[0] < 2 || count[1] < 2) return INFINITY;
+    double variance0 = squares[0] / (count[0] - 1), variance1 = squares[1] / (count[1] - 1);
+    return (mean[0] - mean[1]) / sqrt(variance0 / count[0] + variance1 / count[1]);
+}
+
+// Embed random bits in every group of a buffer; returns the elapsed seconds
+static double benchmarkKernel(Kernel kernel, uint8_t* groups, long count) {
+    uint64_t start = nanoseconds();
+    for (long g = 0; g < count; g++) {
+        uint8_t avg[3];
+        uint8_t bits[3] = { g & 3, (g >> 2) & 3, (g >> 4) & 3 };
+        kernel(avg, groups + g * 4 * 3, BITS_TO_HIDE, bits);
+    }
+    return (double)(nanoseconds() - start) / 1e9;
+}
+
+int main(void) {
+    uint64_t* times = (uint64_t*)malloc(TIMING_MEASUREMENTS * sizeof(uint64_t));
+    uint8_t* classes = (uint8_t*)malloc(TIMING_MEASUREMENTS);
+    uint8_t* cover = (uint8_t*)malloc((size_t)BENCH_GROUPS * 4 * 3);
+    uint8_t* fast = (uint8_t*)malloc((size_t)BENCH_GROUPS * 4 * 3);
+    uint8_t* constant = (uint8_t*)malloc((size_t)BENCH_GROUPS * 4 * 3);
+    if (!times || !classes || !cover || !fast || !constant) {
+        fprintf(stderr, "timing_test: memory allocation failed\n");
+        return 1;
+    }
+
+    double fastLeak = timingLeak(distributeAverage, times, classes);
+    double constantLeak = timingLeak(distributeAverageConstantTime, times, classes);
+    printf("timing_test: fast kernel          t = %7.1f\n", fastLeak);
+    printf("timing_test: constant-time kernel t = %7.1f (threshold %.0f)\n", constantLeak, TIMING_T_THRESHOLD);
+
+    for (size_t i = 0; i < (size_t)BENCH_GROUPS * 4 * 3; i++) {
+        cover[i] = (uint8_t)nextRandom();
+    }
+    memcpy(fast, cover, (size_t)BENCH_GROUPS * 4 * 3);
+    memcpy(constant, cover, (size_t)BENCH_GROUPS * 4 * 3);
+    double fastSeconds = benchmarkKernel(distributeAverage, fast, BENCH_GROUPS);
+    double constantSeconds = benchmarkKernel(distributeAverageConstantTime, constant, BENCH_GROUPS);
+    double megabytes = (double)BENCH_GROUPS * 4 * 3 / (1024 * 1024);
+    printf("timing_test: fast kernel          %7.1f MB/s\n", megabytes / fastSeconds);
+    printf("timing_test: constant-time kernel %7.1f MB/s (%.1fx the fast kernel's time)\n", megabytes / constantSeconds,
+           constantSeconds / fastSeconds);
+
+    int same = memcmp(fast, constant, (size_t)BENCH_GROUPS * 4 * 3) == 0;
+    free(constant);
+    free(fast);
+    free(cover);
+    free(classes);
+    free(times);
+    if (!same) {
+        fprintf(stderr, "timing_test: FAILED, the kernels embed different pixels\n");
+        return 1;
+    }
+    if (!(fabs(constantLeak) < TIMING_T_THRESHOLD)) {
+        fprintf(stderr, "timing_test: FAILED, the constant-time kernel's timing depends on its input\n");
+        return 1;
+    }
+    printf("timing_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "tiles.h"
+
+// Greatest common divisor, for aligning bands to both rows and 4-pixel groups
+static long greatestCommonDivisor(long a, long b) {
+    while (b) {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Bytes per padded pixel row of a 24-bit BMP, from its header (12 when the header is unusable)
+long bmpRowStride(const uint8_t* header) {
+    int32_t width = (int32_t)((uint32_t)header[18] | ((uint32_t)header[19] << 8) | ((uint32_t)header[20] << 16) |
+                              ((uint32_t)header[21] << 24));
+    if (header[0] != 'B' || header[1] != 'M' || width <= 0 || width > (1 << 24)) {
+        return 4 * 3;
+    }
+    return ((long)width * 3 + 3) & ~3L;
+}
+
+// Largest band of whole rows (and whole 4-pixel groups) such that the given number of band
+// buffers fit in the memory budget
+long bandSizeFor(size_t memoryLimit, int buffers, long rowStride) {
+    long unit = rowStride / greatestCommonDivisor(rowStride, 4 * 3) * (4 * 3);
+    long budget = (long)(memoryLimit / buffers);
+    if (budget < MIN_BAND_SIZE) budget = MIN_BAND_SIZE;
+    long bandSize = budget / unit * unit;
+    return bandSize > 0 ? bandSize : unit;
+}
+
+// Pool task: fill the next buffer
+static void prefetchBand(void* argument) {
+    BandReader* reader = (BandReader*)argument;
+    reader->readLength = fread(reader->buffers[reader->next], 1, reader->pendingLength, reader->file);
+}
+
+// Request the next band from the context's worker pool
+static void startPrefetch(BandReader* reader) {
+    if (reader->remaining <= 0) {
+        reader->pending = 0;
+        return;
+    }
+    reader->pendingLength = reader->remaining < (long)reader->bandSize ? (size_t)reader->remaining : reader->bandSize;
+    reader->remaining -= reader->pendingLength;
+    reader->pending = 1;
+    workerPoolSubmit(reader->workers, &reader->task, prefetchBand, reader);
+}
+
+// Prepare to read length bytes from the current position of file in bands of bandSize bytes
+int bandReaderInit(BandReader* reader, StegoArena* arena, WorkerPool* workers, FILE* file, long length, long bandSize) {
+    // A small file is read as one band; the budget is a ceiling, not a size to allocate
+    if (bandSize > length) {
+        bandSize = length > 0 ? length : 1;
+    }
+    reader->file = file;
+    reader->workers = workers;
+    reader->bandSize = bandSize;
+    reader->remaining = length;
+    reader->next = 0;
+    reader->pending = 0;
+    reader->buffers[0] = (uint8_t*)arenaAlloc(arena, bandSize);
+    reader->buffers[1] = (uint8_t*)arenaAlloc(arena, bandSize);
+    if (!reader->buffers[0] || !reader->buffers[1]) {
+        return 0;
+    }
+    startPrefetch(reader);
+    return 1;
+}
+
+// Hand out the next band (valid until the following call) and start reading the one after it;
+// returns 0 at the end of the range
+size_t bandReaderNext(BandReader* reader, uint8_t** band) {
+    if (!reader->pending) {
+        return 0;
+    }
+    workerPoolWait(reader->workers, &reader->task);
+    size_t length = reader->readLength;
+    *band = reader->buffers[reader->next];
+
+    // The caller is done with the other buffer, so the next band can go there
+    reader->next ^= 1;
+    if (length < reader->pendingLength) {
+        reader->remaining = 0; // Short read: the file ended early
+    }
+    startPrefetch(reader);
+    return length;
+}
+
+// Wait for any prefetch still in flight
+void bandReaderClose(BandReader* reader) {
+    if (reader->pending) {
+        workerPoolWait(reader->workers, &reader->task);
+    }
+    reader->pending = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "arena.h"
+#include "workers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Memory budget for image data when --mem-limit is not given
+#define DEFAULT_MEMORY_LIMIT (256L * 1024 * 1024)
+// Bands never shrink below this, whatever the budget
+#define MIN_BAND_SIZE (64L * 1024)
+
+// Reads a byte range of a file as a sequence of bands using two buffers: while the caller works on
+// one band, a pool thread is already reading the next one into the other buffer
+typedef struct {
+    FILE* file;
+    WorkerPool* workers;
+    uint8_t* buffers[2];
+    size_t bandSize;
+    long remaining;         // Bytes not yet requested from the file
+    int next;               // Buffer the next band is (being) read into
+    int pending;            // A prefetch has been submitted and not yet collected
+    size_t pendingLength;   // Bytes requested by the prefetch
+    size_t readLength;      // Bytes the prefetch actually read
+    WorkerTask task;
+} BandReader;
+
+long bandSizeFor(size_t memoryLimit, int buffers, long rowStride);
+long bmpRowStride(const uint8_t* header);
+int bandReaderInit(BandReader* reader, StegoArena* arena, WorkerPool* workers, FILE* file, long length, long bandSize);
+size_t bandReaderNext(BandReader* reader, uint8_t** band);
+void bandReaderClose(BandReader* reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+#include "update.h"
+#include "steganography.h"
+#include "pngcodec.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bits of the payload carried by the given slot (one averaged color component)
+static uint8_t payloadSlot(const uint8_t* data, long totalBits, long slot, int bits_to_hide) {
+    uint8_t value = 0;
+    long bit = slot * bits_to_hide;
+    for (int b = 0; b < bits_to_hide; b++, bit++) {
+        // Bits past the end of the payload are padded with zeros
+        value = (value << 1) | (bit < totalBits ? (data[bit / 8] >> (7 - bit % 8)) & 1 : 0);
+    }
+    return value;
+}
+
+// Write a run of modified groups back to the stego file in one pwrite
+static int flushRun(int fd, long pixelOffset, const uint8_t* block, long blockFirstGroup, long runStart, long runEnd,
+                    long* bytesWritten) {
+    size_t length = (runEnd - runStart) * 4 * 3;
+    const uint8_t* source = block + (runStart - blockFirstGroup) * 4 * 3;
+    if (pwrite(fd, source, length, payloadGroupOffset(pixelOffset, runStart)) != (ssize_t)length) {
+        fprintf(stderr, "Error: Unable to write the updated pixel groups.\n");
+        return FILE_ACCESS_ERROR;
+    }
+    *bytesWritten += length;
+    return SUCCESSFUL;
+}
+
+// Replace the payload hidden in a stego file in place, rewriting only the pixel groups whose bits change
+int updateData(StegoContext* context, FILE* inputFile, const char* stegoPath, int bits_to_hide) {
+    // Groups are patched through their average color, which luma mode does not use
+    if (context->luma) {
+        fprintf(stderr, "Error: --luma is only supported by -hide and -extract.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+
+    // Frame the new payload exactly as hideData would embed it, checksum included
+    arenaReset(&context->arena);
+    long totalInputSize = 0;
+    uint8_t* inputData = loadPayload(context, inputFile, &totalInputSize);
+    uint8_t* block = (uint8_t*)arenaAlloc(&context->arena, UPDATE_BLOCK_GROUPS * 4 * 3);
+    if (!inputData || !block) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return GENERAL_ERROR;
+    }
+    sealPayload(inputData);
+
+    // Check the stego file was written with the same bit depth and can hold the new payload
+    FILE* stegoFile = NULL;
+    int result = fileAccessCheck((char*)stegoPath, &stegoFile, READ_FILE);
+    if (result) return result;
+    // Groups are patched at fixed file offsets, which only a BMP has
+    if (isPngFile(stegoFile)) {
+        fprintf(stderr, "Error: PNG images are only supported by -hide and -extract.\n");
+        fclose(stegoFile);
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    int hidden_bits_to_hide = readBitDepth(stegoFile);
+    long pixelOffset = bmpPixelOffset(stegoFile);
+    long capacity = coverCapacity(stegoFile, bits_to_hide);
+    fclose(stegoFile);
+    if (hidden_bits_to_hide > 0 && (hidden_bits_to_hide & LUMA_FLAG)) {
+        fprintf(stderr, "Error: Luma stego files (--luma) are only supported by -extract.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (hidden_bits_to_hide != bits_to_hide) {
+        fprintf(stderr, "Error: Number of bits for update does not match the number of bits used for hiding.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    if (totalInputSize > capacity) {
+        fprintf(stderr, "Error: Payload of %ld bytes exceeds the cover capacity of %ld bytes.\n", totalInputSize, capacity);
+        return CAPACITY_ERROR;
+    }
+
+    int fd = open(stegoPath, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Unable to open the file for update: %s\n", stegoPath);
+        return FILE_ACCESS_ERROR;
+    }
+
+    // Walk the groups holding the new payload block by block, diffing the embedded bits against it
+    long totalSlots = (totalInputSize * 8 + bits_to_hide - 1) / bits_to_hide;
+    long totalGroups = (totalSlots + 2) / 3;
+    long groupsChanged = 0;
+    long bytesWritten = 0;
+    for (long first = 0; first < totalGroups && !result; first += UPDATE_BLOCK_GROUPS) {
+        long count = totalGroups - first < UPDATE_BLOCK_GROUPS ? totalGroups - first : UPDATE_BLOCK_GROUPS;
+        size_t length = count * 4 * 3;
+        if (pread(fd, block, length, payloadGroupOffset(pixelOffset, first)) != (ssize_t)length) {
+            fprintf(stderr, "Error: Unable to read the stego file: %s\n", stegoPath);
+            result = FILE_ACCESS_ERROR;
+            break;
+        }
+
+        long runStart = -1;
+        for (long g = first; g < first + count && !result; g++) {
+            uint8_t* pixels = block + (g - first) * 4 * 3;
+            uint8_t avg[3];
+            averageColors(avg, pixels);
+
+            // Compare the bits currently embedded with the bits the new payload needs
+            uint8_t bits[3];
+            int changed = 0;
+            for (int i = 0; i < 3; ++i) {
+                long slot = g * 3 + i;
+                bits[i] = extractBits(avg[i], bits_to_hide);
+                if (slot < totalSlots) {
+                    uint8_t wanted = payloadSlot(inputData, totalInputSize * 8, slot, bits_to_hide);
+                    changed |= (wanted != bits[i]);
+                    bits[i] = wanted;
+                }
+            }
+
+            if (changed) {
+                // Re-embed the group and extend the current run of dirty groups
+                if (context->constantTime) {
+                    distributeAverageConstantTime(avg, pixels, bits_to_hide, bits);
+                } else {
+                    distributeAverage(avg, pixels, bits_to_hide, bits);
+                }
+                groupsChanged++;
+                if (runStart < 0) runStart = g;
+            } else if (runStart >= 0) {
+                result = flushRun(fd, pixelOffset, block, first, runStart, g, &bytesWritten);
+                runStart = -1;
+            }
+        }
+        if (runStart >= 0 && !result) {
+            result = flushRun(fd, pixelOffset, block, first, runStart, first + count, &bytesWritten);
+        }
+        // The file is patched in place, so a cancel request cannot stop the update half way without
+        // leaving a mix of both payloads; progress is still reported
+        stegoReportProgress(context, (uint64_t)(first + count) * 4 * 3, (uint64_t)totalGroups * 4 * 3);
+    }
+
+    close(fd);
+    if (!result) {
+        printf("Updated %ld of %ld pixel groups (%ld bytes written).\n", groupsChanged, totalGroups, bytesWritten);
+    }
+    return result;
+}
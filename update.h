@@ -0,0 +1,21 @@
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdio.h>
+#include "utils.h"
+#include "steganography.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of 4-pixel groups read per pread call while diffing
+#define UPDATE_BLOCK_GROUPS 4096
+
+int updateData(StegoContext* context, FILE* inputFile, const char* stegoPath, int bits_to_hide);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,21 +1,102 @@
 #include "utils.h"
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 int global_bits_to_hide = -1; // Initialize the global variable to store bits used for hiding
 
+// Parse a byte count with an optional K, M or G suffix
+static int parseSize(const char* text, size_t* size) {
+    char* end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || text[0] == '-') return 0; // No digits, or a negative number
+    switch (*end) { // Apply the unit suffix, if any
+        case 'G': case 'g': value <<= 10; // Fall through
+        case 'M': case 'm': value <<= 10; // Fall through
+        case 'K': case 'k': value <<= 10; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value == 0) return 0; // Trailing characters or a zero budget
+    *size = (size_t)value;
+    return 1;
+}
+
+// Parse a bit count: a whole number from 1 to 4 with nothing after it
+static int parseBits(const char* text, int* bits) {
+    char* end = NULL;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 1 || value > 4) return 0;
+    *bits = (int)value;
+    return 1;
+}
+
+// Remove options that apply to every command from the argument list before the per-command checks
+int checkGlobalOptions(int* arguments, char* list[], GlobalOptions* options) {
+    int kept = 1; // The program name always stays
+    for (int i = 1; i < *arguments; i++) {
+        if (strcmp(list[i], MEM_LIMIT_FLAG) == 0) { // Memory budget for image data
+            if (i + 1 >= *arguments || !parseSize(list[i + 1], &options->memoryLimit)) {
+                fprintf(stderr, "Missing or incorrect memory limit.\n");
+                return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+            }
+            i++; // Skip the value
+        } else if (strcmp(list[i], PNG_LEVEL_FLAG) == 0) { // zlib level for PNG output
+            if (i + 1 >= *arguments || strlen(list[i + 1]) != 1 || list[i + 1][0] < '0' || list[i + 1][0] > '9') {
+                fprintf(stderr, "Missing or incorrect PNG compression level (0-9).\n");
+                return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+            }
+            options->pngLevel = list[i + 1][0] - '0';
+            i++; // Skip the value
+        } else if (strcmp(list[i], CONSTANT_TIME_FLAG) == 0) { // Constant-time embedding kernel
+            options->constantTime = 1;
+        } else if (strcmp(list[i], LUMA_OPTION_FLAG) == 0) { // Luma embedding
+            options->luma = 1;
+        } else if (strcmp(list[i], PROGRESS_FLAG) == 0) { // Progress display
+            options->progress = 1;
+        } else {
+            list[kept++] = list[i]; // Keep everything else in order
+        }
+    }
+    // The luma kernel searches for its shift, so its timing depends on the payload
+    if (options->luma && options->constantTime) {
+        fprintf(stderr, "Error: --luma cannot be combined with --constant-time.\n");
+        return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+    }
+    *arguments = kept;
+    list[kept] = NULL; // Keep the list NULL terminated like argv
+    return SUCCESSFUL;
+}
+
 // Check command line parameters
 int checkParams(const int arguments, char* const list[], int* selection, int* optional, int* bits_to_hide) {
-    // Check if the number of arguments is correct (should be either 8 or 10 for hide, 6 or 8 for extract)
+    // Check if the number of arguments is correct (should be either 8 or 10 for hide, archive and shard, 6 or 8 for
+    // extract and unshard, 6 for list, 8 or 10 for member, 8 for update and 4 or 6 for analyze, scan and bench)
     if ((strncmp(list[1], HIDE, strlen(HIDE)) == 0 && arguments != 8 && arguments != 10) ||
-        (strncmp(list[1], EXTRACT, strlen(EXTRACT)) == 0 && arguments != 6 && arguments != 8)) {
+        (strncmp(list[1], EXTRACT, strlen(EXTRACT)) == 0 && arguments != 6 && arguments != 8) ||
+        (strcmp(list[1], ARCHIVE) == 0 && arguments != 8 && arguments != 10) ||
+        (strcmp(list[1], SHARD) == 0 && arguments != 8 && arguments != 10) ||
+        (strcmp(list[1], UNSHARD) == 0 && arguments != 6 && arguments != 8) ||
+        (strcmp(list[1], UPDATE) == 0 && arguments != 8) ||
+        (strcmp(list[1], ANALYZE) == 0 && arguments != 4 && arguments != 6) ||
+        (strcmp(list[1], SCAN) == 0 && arguments != 4 && arguments != 6) ||
+        (strcmp(list[1], BENCH) == 0 && arguments != 4 && arguments != 6) ||
+        (strcmp(list[1], LIST) == 0 && arguments != 6) ||
+        (strcmp(list[1], MEMBER) == 0 && arguments != 8 && arguments != 10)) {
         fprintf(stderr, "Incorrect number of parameters. Provided: %d\n", arguments);
         return INCORRECT_NUM_PARAMETERS;
     }
 
-    // Check if the first argument is the hide command
-    if (strncmp(list[1], HIDE, strlen(HIDE)) == 0) {
-        *selection = 0; // Set selection to hide
+    // Check if the first argument is the hide, archive or shard command (all take a message and a cover)
+    if (strncmp(list[1], HIDE, strlen(HIDE)) == 0 || strcmp(list[1], ARCHIVE) == 0 || strcmp(list[1], SHARD) == 0) {
+        // Set selection to hide, archive or shard
+        if (strcmp(list[1], ARCHIVE) == 0) {
+            *selection = SELECT_ARCHIVE;
+        } else if (strcmp(list[1], SHARD) == 0) {
+            *selection = SELECT_SHARD;
+        } else {
+            *selection = SELECT_HIDE;
+        }
         
         // Check if the message flag is correct
         if (strncmp(list[2], MSG_FLAG, strlen(MSG_FLAG)) != 0) {
@@ -35,8 +116,11 @@ int checkParams(const int arguments, char* const list[], int* selection, int* op
             return PARAMETERS_PROVIDED_INCORRECT_ERROR;
         }
 
-        // Convert the bits argument to an integer and store it
-        *bits_to_hide = atoi(list[7]);
+        // Convert the bits argument to an integer and store it (1 to 4 bits per color component)
+        if (!parseBits(list[7], bits_to_hide)) {
+            fprintf(stderr, "Number of bits must be between 1 and 4. Provided: %s\n", list[7]);
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
 
         // If optional arguments are provided, check if the optional flag is correct
         if (arguments == 10) {
@@ -51,9 +135,10 @@ int checkParams(const int arguments, char* const list[], int* selection, int* op
             *optional = 1; // Set optional flag to true
         }
 
-    // Check if the first argument is the extract command
-    } else if (strncmp(list[1], EXTRACT, strlen(EXTRACT)) == 0) {
-        *selection = 1; // Set selection to extract
+    // Check if the first argument is the extract or unshard command
+    } else if (strncmp(list[1], EXTRACT, strlen(EXTRACT)) == 0 || strcmp(list[1], UNSHARD) == 0) {
+        // Set selection to extract or unshard
+        *selection = (strcmp(list[1], UNSHARD) == 0) ? SELECT_UNSHARD : SELECT_EXTRACT;
         
         // Check if the stego flag is correct
         if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
@@ -67,8 +152,11 @@ int checkParams(const int arguments, char* const list[], int* selection, int* op
             return PARAMETERS_PROVIDED_INCORRECT_ERROR;
         }
 
-        // Convert the bits argument to an integer and store it
-        *bits_to_hide = atoi(list[5]);
+        // Convert the bits argument to an integer and store it (1 to 4 bits per color component)
+        if (!parseBits(list[5], bits_to_hide)) {
+            fprintf(stderr, "Number of bits must be between 1 and 4. Provided: %s\n", list[5]);
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
 
         // If optional arguments are provided, check if the optional flag is correct
         if (arguments == 8) {
@@ -83,7 +171,155 @@ int checkParams(const int arguments, char* const list[], int* selection, int* op
             *optional = 1; // Set optional flag to true
         }
 
-    // If the first argument is not hide or extract, print an error message and return error code for incorrect first parameter
+    // Check if the first argument is the list command
+    } else if (strcmp(list[1], LIST) == 0) {
+        *selection = SELECT_LIST; // Set selection to list
+
+        // Check if the stego flag is correct
+        if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // Check if the bits flag is correct
+        if (strncmp(list[4], BITS, strlen(BITS)) != 0) {
+            fprintf(stderr, "Missing or incorrect bits flag.\n");
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+        // Convert the bits argument to an integer and store it (1 to 4 bits per color component)
+        if (!parseBits(list[5], bits_to_hide)) {
+            fprintf(stderr, "Number of bits must be between 1 and 4. Provided: %s\n", list[5]);
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+    // Check if the first argument is the member command
+    } else if (strcmp(list[1], MEMBER) == 0) {
+        *selection = SELECT_MEMBER; // Set selection to member
+
+        // Check if the stego flag is correct
+        if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // Check if the bits flag is correct
+        if (strncmp(list[4], BITS, strlen(BITS)) != 0) {
+            fprintf(stderr, "Missing or incorrect bits flag.\n");
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+        // Convert the bits argument to an integer and store it (1 to 4 bits per color component)
+        if (!parseBits(list[5], bits_to_hide)) {
+            fprintf(stderr, "Number of bits must be between 1 and 4. Provided: %s\n", list[5]);
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+        // Check if the member name flag is correct
+        if (strncmp(list[6], NAME_FLAG, strlen(NAME_FLAG)) != 0 || strlen(list[7]) == 0) {
+            fprintf(stderr, "Missing or incorrect member name flag.\n");
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+        // If optional arguments are provided, check if the optional flag is correct
+        if (arguments == 10) {
+            if (strncmp(list[8], OPTIONAL_FLAG, strlen(OPTIONAL_FLAG)) != 0) {
+                fprintf(stderr, "Missing or incorrect optional flag.\n");
+                return OPTIONAL_ERROR;
+            }
+            if (list[9] == NULL || strlen(list[9]) == 0) {
+                fprintf(stderr, "Missing output file name.\n");
+                return INCORRECT_NUM_PARAMETERS;
+            }
+            *optional = 1; // Set optional flag to true
+        }
+
+    // Check if the first argument is the update command
+    } else if (strcmp(list[1], UPDATE) == 0) {
+        *selection = SELECT_UPDATE; // Set selection to update
+
+        // Check if the message flag is correct
+        if (strncmp(list[2], MSG_FLAG, strlen(MSG_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect message flag.\n");
+            return MSG_ERROR;
+        }
+
+        // Check if the stego flag is correct
+        if (strncmp(list[4], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // Check if the bits flag is correct
+        if (strncmp(list[6], BITS, strlen(BITS)) != 0) {
+            fprintf(stderr, "Missing or incorrect bits flag.\n");
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+        // Convert the bits argument to an integer and store it (1 to 4 bits per color component)
+        if (!parseBits(list[7], bits_to_hide)) {
+            fprintf(stderr, "Number of bits must be between 1 and 4. Provided: %s\n", list[7]);
+            return PARAMETERS_PROVIDED_INCORRECT_ERROR;
+        }
+
+    // Check if the first argument is the analyze command
+    } else if (strcmp(list[1], ANALYZE) == 0) {
+        *selection = SELECT_ANALYZE; // Set selection to analyze
+
+        // Check if the stego flag is correct
+        if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // If a cover is provided, check if the cover flag is correct
+        if (arguments == 6) {
+            if (strncmp(list[4], COVER_FLAG, strlen(COVER_FLAG)) != 0) {
+                fprintf(stderr, "Missing or incorrect cover flag.\n");
+                return COVER_ERROR;
+            }
+            *optional = 1; // Set optional flag to true
+        }
+
+    // Check if the first argument is the scan command
+    } else if (strcmp(list[1], SCAN) == 0) {
+        *selection = SELECT_SCAN; // Set selection to scan
+
+        // Check if the stego flag (the directory to scan) is correct
+        if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // If a report file is provided, check if the optional flag is correct
+        if (arguments == 6) {
+            if (strncmp(list[4], OPTIONAL_FLAG, strlen(OPTIONAL_FLAG)) != 0) {
+                fprintf(stderr, "Missing or incorrect optional flag.\n");
+                return OPTIONAL_ERROR;
+            }
+            *optional = 1; // Set optional flag to true
+        }
+
+    // Check if the first argument is the bench command
+    } else if (strcmp(list[1], BENCH) == 0) {
+        *selection = SELECT_BENCH; // Set selection to bench
+
+        // Check if the stego flag (the work directory) is correct
+        if (strncmp(list[2], STEGO_FLAG, strlen(STEGO_FLAG)) != 0) {
+            fprintf(stderr, "Missing or incorrect stego flag.\n");
+            return STEGO_ERROR;
+        }
+
+        // If a baseline file is provided, check if the optional flag is correct
+        if (arguments == 6) {
+            if (strncmp(list[4], OPTIONAL_FLAG, strlen(OPTIONAL_FLAG)) != 0) {
+                fprintf(stderr, "Missing or incorrect optional flag.\n");
+                return OPTIONAL_ERROR;
+            }
+            *optional = 1; // Set optional flag to true
+        }
+
+    // If the first argument is not a known command, print an error message and return error code for incorrect first parameter
     } else {
         fprintf(stderr, "First parameter is incorrect. Provided: %s\n", list[1]);
         return PARAMETERS_PROVIDED_INCORRECT_ERROR;
@@ -118,19 +354,114 @@ int fileAccessCheck(char* filename, FILE** fp, int readOrWrite) {
     return SUCCESSFUL; // Return success code if the file can be accessed
 }
 
+// Create a temporary file for an output next to its target (same directory, so the final rename
+// is atomic); the name is unique per process, with a counter on the rare clash
+int outputFileOpen(OutputFile* output, const char* path) {
+    memset(output, 0, sizeof(*output));
+    if (strlen(path) + 32 > sizeof(output->tempPath)) {
+        fprintf(stderr, "Error: Output file name is too long: %s\n", path);
+        return FILE_ACCESS_ERROR;
+    }
+    // A target that exists but cannot be written is refused, as opening it directly would be
+    if (access(path, F_OK) == 0 && access(path, W_OK) != 0) {
+        fprintf(stderr, "Error: Access to write the file denied: %s\n", path);
+        return ACCESS_DENIED;
+    }
+    strcpy(output->path, path);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        snprintf(output->tempPath, sizeof(output->tempPath), "%s.%ld.%d.part", path, (long)getpid(), attempt);
+        int fd = open(output->tempPath, O_WRONLY | O_CREAT | O_EXCL, 0666); // Permissions follow the umask
+        if (fd < 0 && errno == EEXIST) continue;
+        output->file = fd < 0 ? NULL : fdopen(fd, "wb");
+        if (!output->file) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        return SUCCESSFUL;
+    }
+    fprintf(stderr, "Error: Unable to open or create the file: %s\n", path);
+    output->tempPath[0] = '\0';
+    return FILE_ACCESS_ERROR;
+}
+
+// Close the temporary file and move it over the target; the temporary file is removed on failure
+int outputFileCommit(OutputFile* output) {
+    if (!output->file) return FILE_ACCESS_ERROR;
+    int closed = fclose(output->file) == 0;
+    output->file = NULL;
+    if (!closed || rename(output->tempPath, output->path) != 0) {
+        fprintf(stderr, "Error: Unable to create or write to the file: %s\n", output->path);
+        remove(output->tempPath);
+        output->tempPath[0] = '\0';
+        return FILE_ACCESS_ERROR;
+    }
+    output->tempPath[0] = '\0';
+    return SUCCESSFUL;
+}
+
+// Close and remove the temporary file, leaving any existing target as it was; safe to call twice
+void outputFileDiscard(OutputFile* output) {
+    if (output->file) {
+        fclose(output->file);
+        output->file = NULL;
+    }
+    if (output->tempPath[0]) {
+        remove(output->tempPath);
+        output->tempPath[0] = '\0';
+    }
+}
+
 // Display the command line usage menu
 void displayMenu() {
     printf("Usage: stego [options]\n"); // Print usage instructions
     printf("Options:\n");
+    printf("  --mem-limit <size>\n");
+    printf("    (Any command) Memory budget for image data, e.g. 64M or 1G. Larger images are streamed in bands.\n");
+    printf("  --png-level <0-9>\n");
+    printf("    (Any command) zlib level for PNG output. Default is 6.\n");
+    printf("  --constant-time\n");
+    printf("    (Any command) Embed with a kernel whose timing does not depend on the hidden bits.\n");
+    printf("  --progress\n");
+    printf("    (-hide, -archive, -shard, -extract, -unshard, -member, -update, -analyze) Show the progress of the\n");
+    printf("    operation. Ctrl-C cancels cleanly: outputs are written to a temporary file and only renamed into place\n");
+    printf("    once complete.\n");
+    printf("  --luma\n");
+    printf("    (-hide) Hide <bits> bits in the luma of each pixel (4 per group instead of 3) without shifting its color.\n");
+    printf("    -extract detects it; other commands refuse it.\n");
     printf("  -hide -m <message_file> -c <cover_file> -b <bits> [-o <output_file>]\n");
-    printf("    Hide a message in a BMP file using 4 pixels.\n");
+    printf("    Hide a message in a BMP or 8-bit RGB PNG file using 4 pixels; the output has the cover's format.\n");
     printf("    -m <message_file> : File containing the message to hide.\n");
     printf("    -c <cover_file>   : BMP file to use as cover.\n");
     printf("    -b <bits>         : Number of bits to use per color component (1-4).\n");
     printf("    -o <output_file>  : (Optional) Output BMP file name. Default is 'output_stego.bmp'.\n");
     printf("  -extract -s <stego_file> -b <bits> [-o <output_file>]\n");
-    printf("    Extract a message from a BMP file using 4 pixels.\n");
+    printf("    Extract a message from a BMP or PNG file using 4 pixels.\n");
     printf("    -s <stego_file>   : BMP file containing the hidden message.\n");
     printf("    -b <bits>         : Number of bits used per color component (1-4).\n");
     printf("    -o <output_file>  : (Optional) Output text file name. Default is 'output_message.txt'.\n");
+    printf("  -archive -m <file1,file2,...> -c <cover_file> -b <bits> [-o <output_file>]\n");
+    printf("    Hide several files as one archive with a directory table at the start of the pixel data.\n");
+    printf("    -m <file1,...>    : Comma separated list of files to archive.\n");
+    printf("  -shard -m <message_file> -c <cover1,cover2,...> -b <bits> [-o <output_prefix>]\n");
+    printf("    Split a message too large for one cover across several covers, embedded in parallel.\n");
+    printf("    -o <output_prefix>: (Optional) Shards are written to <prefix>_<n>.bmp. Default is 'output_shard'.\n");
+    printf("  -unshard -s <stego1,stego2,...> -b <bits> [-o <output_file>]\n");
+    printf("    Reassemble a sharded message; the stego files may be given in any order.\n");
+    printf("  -update -m <message_file> -s <stego_file> -b <bits>\n");
+    printf("    Replace the message hidden in a stego file in place, rewriting only the pixel groups that change.\n");
+    printf("  -analyze -s <stego_file> [-c <cover_file>]\n");
+    printf("    Run chi-square, RS and sample pair steganalysis; exits with an error if the image is detectable.\n");
+    printf("    -c <cover_file>   : (Optional) Original cover, to judge the change and report PSNR.\n");
+    printf("  -scan -s <directory> [-o <report_file>]\n");
+    printf("    List the BMP files under a directory that carry a message, archive or shard, reading only their first bytes.\n");
+    printf("    -o <report_file>  : (Optional) Write the candidates to a file instead of the console.\n");
+    printf("  -bench -s <work_directory> [-o <baseline_file>]\n");
+    printf("    Generate test covers and payloads, time this program's -hide and -extract at bits 1-4 and check the round trip.\n");
+    printf("    -o <baseline_file>: (Optional) Compare with this baseline (error 16 when a case is over 20%% slower or missing), or create it.\n");
+    printf("  -list -s <stego_file> -b <bits>\n");
+    printf("    List the members of an archive hidden in a BMP file.\n");
+    printf("  -member -s <stego_file> -b <bits> -n <name> [-o <output_file>]\n");
+    printf("    Extract a single archive member without decoding the rest of the image.\n");
+    printf("    -n <name>         : Name of the archive member to extract.\n");
+    printf("    -o <output_file>  : (Optional) Output file name. Default is the member name.\n");
 }
@@ -12,11 +12,38 @@
 
 #define HIDE "-hide"
 #define EXTRACT "-extract"
+#define ARCHIVE "-archive"
+#define LIST "-list"
+#define MEMBER "-member"
+#define SHARD "-shard"
+#define UNSHARD "-unshard"
+#define UPDATE "-update"
+#define ANALYZE "-analyze"
+#define SCAN "-scan"
+#define BENCH "-bench"
 #define MSG_FLAG "-m"
 #define OPTIONAL_FLAG "-o"
 #define COVER_FLAG "-c"
 #define STEGO_FLAG "-s"
 #define BITS "-b"
+#define NAME_FLAG "-n"
+#define MEM_LIMIT_FLAG "--mem-limit"
+#define PNG_LEVEL_FLAG "--png-level"
+#define CONSTANT_TIME_FLAG "--constant-time"
+#define LUMA_OPTION_FLAG "--luma"
+#define PROGRESS_FLAG "--progress"
+
+#define SELECT_HIDE 0
+#define SELECT_EXTRACT 1
+#define SELECT_ARCHIVE 2
+#define SELECT_LIST 3
+#define SELECT_MEMBER 4
+#define SELECT_SHARD 5
+#define SELECT_UNSHARD 6
+#define SELECT_UPDATE 7
+#define SELECT_ANALYZE 8
+#define SELECT_SCAN 9
+#define SELECT_BENCH 10
 
 #define READ_FILE 0
 #define WRITE_FILE 1
@@ -33,15 +60,42 @@
 #define STEGO_ERROR 10
 #define FILE_ACCESS_ERROR 11
 #define ACCESS_DENIED 12
+#define CAPACITY_ERROR 13
+#define INTEGRITY_ERROR 14
+#define DETECTABLE_ERROR 15
+#define REGRESSION_ERROR 16
+#define CANCELLED_ERROR 17
 
 #define DEFAULT_HIDE_OUTPUT_FILE "output_stego.bmp"
+#define DEFAULT_HIDE_PNG_OUTPUT_FILE "output_stego.png"  // The default when the cover is a PNG
 #define DEFAULT_EXTRACT_OUTPUT_FILE "output_message.txt"
 #define TERMINATOR_SEQUENCE "END_OF_MESSAGE"
 
 extern int global_bits_to_hide;  // Declare the global variable
 
+// Options accepted before or after any command
+typedef struct {
+    size_t memoryLimit;  // --mem-limit: budget for image data buffers
+    int pngLevel;        // --png-level: zlib level for PNG output
+    int constantTime;    // --constant-time: embed without timing that depends on the payload
+    int luma;            // --luma: embed in the luma of each pixel
+    int progress;        // --progress: show the progress of long operations
+} GlobalOptions;
+
+// Output written under a temporary name next to its target and renamed over it once complete, so
+// a failed or cancelled run never leaves a partial file behind
+typedef struct {
+    FILE* file;
+    char path[FILENAME_MAX];
+    char tempPath[FILENAME_MAX];
+} OutputFile;
+
 void displayMenu();
+int checkGlobalOptions(int* arguments, char* list[], GlobalOptions* options);
 int checkParams(const int arguments, char* const list[], int* selection, int* optional, int* bits_to_hide);
 int fileAccessCheck(char* filename, FILE** fp, int readOrWrite);
+int outputFileOpen(OutputFile* output, const char* path);
+int outputFileCommit(OutputFile* output);
+void outputFileDiscard(OutputFile* output);
 
 #endif
@@ -0,0 +1,106 @@
+#include "workers.h"
+#include <unistd.h>
+
+// Set up an empty pool sized to the processor count; no thread is started until work arrives
+void workerPoolInit(WorkerPool* pool) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->queued = 0;
+    pool->threadCount = 0;
+    pool->started = 0;
+    pool->stopping = 0;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    pool->limit = processors < 1 ? 1 : (processors > WORKER_MAX_THREADS ? WORKER_MAX_THREADS : (int)processors);
+}
+
+// Number of tasks the pool can run at once
+int workerPoolSize(const WorkerPool* pool) {
+    return pool->limit;
+}
+
+// Thread body: run queued tasks until the pool is released
+static void* workerMain(void* argument) {
+    WorkerPool* pool = (WorkerPool*)argument;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (!pool->head) break; // Stopping, and nothing left to run
+
+        WorkerTask* task = pool->head;
+        pool->head = task->next;
+        if (!pool->head) pool->tail = NULL;
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->run(task->argument);
+
+        pthread_mutex_lock(&pool->lock);
+        task->done = 1;
+        pthread_cond_broadcast(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Queue a task. The first task starts all of the pool's threads at once, so a repeated workload
+// never starts another one later. If no thread can be started at all the task runs on the
+// caller's thread before this returns.
+void workerPoolSubmit(WorkerPool* pool, WorkerTask* task, void (*run)(void*), void* argument) {
+    task->run = run;
+    task->argument = argument;
+    task->next = NULL;
+    task->done = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->started) {
+        pool->started = 1;
+        while (pool->threadCount < pool->limit &&
+               pthread_create(&pool->threads[pool->threadCount], NULL, workerMain, pool) == 0) {
+            pool->threadCount++;
+        }
+    }
+    if (pool->threadCount == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        run(argument);
+        task->done = 1;
+        return;
+    }
+    if (pool->tail) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pool->queued++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Block until a submitted task has finished
+void workerPoolWait(WorkerPool* pool, WorkerTask* task) {
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Let the threads finish the queued work, then stop them
+void workerPoolRelease(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pool->threadCount = 0;
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
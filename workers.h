@@ -0,0 +1,48 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A pool never starts more threads than this, whatever the processor count
+#define WORKER_MAX_THREADS 64
+
+// One unit of work handed to a pool. The submitter owns it and waits for it before reusing it.
+typedef struct WorkerTask {
+    void (*run)(void* argument);
+    void* argument;
+    struct WorkerTask* next;
+    int done;
+} WorkerTask;
+
+// Threads kept for the lifetime of a context, so streaming work (band prefetches, analysis shares,
+// PNG deflate chunks) does not start and join a thread per band. All threads are started with the
+// first task and stopped when the pool is released.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // Work was queued, or the pool is stopping
+    pthread_cond_t finished;    // A task completed
+    WorkerTask* head;           // Tasks not yet picked up, oldest first
+    WorkerTask* tail;
+    int queued;
+    pthread_t threads[WORKER_MAX_THREADS];
+    int threadCount;
+    int started;                // Threads have been started (by the first task)
+    int limit;                  // Threads to start; may be lowered before the first task
+    int stopping;
+} WorkerPool;
+
+void workerPoolInit(WorkerPool* pool);
+int workerPoolSize(const WorkerPool* pool);
+void workerPoolSubmit(WorkerPool* pool, WorkerTask* task, void (*run)(void*), void* argument);
+void workerPoolWait(WorkerPool* pool, WorkerTask* task);
+void workerPoolRelease(WorkerPool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif